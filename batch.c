@@ -0,0 +1,457 @@
+// batch.c - Micro-batched processing of many small images in a single row stream
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "convolve.h"
+#include "pool.h"
+#include "scratch.h"
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+#define BATCH_PIXELS (1 << 22)     // decoded pixels per micro-batch
+#define BATCH_MAX_IMAGES 256
+#define BATCH_LANES 8              // same-sized images interleaved into one packed unit
+
+typedef struct {
+    char *path;
+    unsigned char *pixels;
+    unsigned char *output;
+    int width;
+    int height;
+    int channels;
+    unsigned long long hash;  // of the input file's contents, when resuming from a manifest
+    int skipped;              // an earlier run already produced this output
+    long long written;        // size of the output file once it has been written
+    int failed;               // its output couldn't be written
+    int mode;                 // from the job's plan, PLAN_FULL without one
+} batch_image_t;
+
+// A unit is one image, or up to BATCH_LANES same-sized images interleaved sample by sample so the
+// convolution's inner loop runs across images.  Units are stacked into one stream of rows.
+typedef struct {
+    int first;           // index into the micro-batch's order array
+    int lanes;
+    int start_row;       // first row of this unit in the stream
+    thread_data_t data;  // for packed units, channels is channels*lanes
+} batch_unit_t;
+
+typedef struct {
+    batch_config_t *config;
+    batch_image_t *images;
+    int *order;
+    batch_unit_t *units;
+    int num_units;
+} batch_job_t;
+
+typedef void (*unit_task_t)(batch_job_t *job, batch_unit_t *unit, int start_row, int end_row);
+
+static void output_path(const char *outdir, const char *input, char *path, size_t size) {
+    const char *base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    const char *dot = strrchr(base, '.');
+    int stem = dot ? (int)(dot - base) : (int)strlen(base);
+    snprintf(path, size, "%s/%.*s_out.png", outdir, stem, base);
+}
+
+static unsigned char *read_file(const char *path, size_t *length) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *data = size > 0 ? malloc(size) : NULL;
+    if (data && fread(data, 1, size, f) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *length = data ? (size_t)size : 0;
+    return data;
+}
+
+// With a manifest, each input is read once: its bytes are hashed to check for earlier work and then
+// decoded from memory only if that work is missing
+static void decode_images(void *arg, int start, int end) {
+    batch_job_t *job = (batch_job_t *)arg;
+    manifest_t *manifest = job->config->manifest;
+    char path[4096];
+
+    for (int i = start; i < end; i++) {
+        batch_image_t *image = &job->images[i];
+        image->skipped = 0;
+        image->written = 0;
+        image->failed = 0;
+        image->pixels = NULL;
+        image->output = NULL;
+        if (image->mode == PLAN_REJECT) {
+            continue;
+        } else if (!manifest) {
+            image->pixels = stbi_load(image->path, &image->width, &image->height, &image->channels, 0);
+        } else {
+            size_t length;
+            unsigned char *data = read_file(image->path, &length);
+            image->pixels = NULL;
+            if (data) {
+                image->hash = hash_bytes(data, length);
+                output_path(job->config->outdir, image->path, path, sizeof(path));
+                image->skipped = manifest_done(manifest, image->hash, path);
+                if (!image->skipped) {
+                    image->pixels = stbi_load_from_memory(data, (int)length, &image->width, &image->height,
+                                                          &image->channels, 0);
+                }
+                free(data);
+            }
+        }
+        // Out-of-core jobs write their output straight from the tiled filter
+        if (image->pixels && image->mode == PLAN_FULL) {
+            image->output = malloc((size_t)image->width * image->height * image->channels);
+        }
+    }
+}
+
+// Maps a band of stream rows onto the units they belong to
+static void for_unit_rows(batch_job_t *job, int start_row, int end_row, unit_task_t task) {
+    int lo = 0, hi = job->num_units - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (job->units[mid].start_row <= start_row) lo = mid;
+        else hi = mid - 1;
+    }
+    for (int u = lo; u < job->num_units && start_row < end_row; u++) {
+        batch_unit_t *unit = &job->units[u];
+        int unit_end = unit->start_row + unit->data.height;
+        int stop = end_row < unit_end ? end_row : unit_end;
+        task(job, unit, start_row - unit->start_row, stop - unit->start_row);
+        start_row = stop;
+    }
+}
+
+static void pack_unit(batch_job_t *job, batch_unit_t *unit, int start_row, int end_row) {
+    if (unit->lanes == 1) return;
+    int channels = job->images[job->order[unit->first]].channels;
+    int width = unit->data.width;
+    for (int l = 0; l < unit->lanes; l++) {
+        unsigned char *src = job->images[job->order[unit->first + l]].pixels;
+        for (int y = start_row; y < end_row; y++) {
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < channels; c++) {
+                    unit->data.input[((size_t)y * width + x) * unit->data.channels + c * unit->lanes + l] =
+                        src[((size_t)y * width + x) * channels + c];
+                }
+            }
+        }
+    }
+}
+
+static void unpack_unit(batch_job_t *job, batch_unit_t *unit, int start_row, int end_row) {
+    if (unit->lanes == 1) return;
+    int channels = job->images[job->order[unit->first]].channels;
+    int width = unit->data.width;
+    for (int l = 0; l < unit->lanes; l++) {
+        unsigned char *dst = job->images[job->order[unit->first + l]].output;
+        for (int y = start_row; y < end_row; y++) {
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < channels; c++) {
+                    dst[((size_t)y * width + x) * channels + c] =
+                        unit->data.output[((size_t)y * width + x) * unit->data.channels + c * unit->lanes + l];
+                }
+            }
+        }
+    }
+}
+
+// Same arithmetic, in the same order, as apply_convolution_rows, but the innermost loop runs over
+// the interleaved samples of every image in the unit so it compiles to vector multiply-adds
+static void convolve_lanes(thread_data_t *data, int start_row, int end_row) {
+    int half = data->kernel_size / 2;
+    int lanes = data->channels;
+    int width = data->width;
+    float *acc = malloc((size_t)width * lanes * sizeof(float));
+
+    for (int y = start_row; y < end_row; y++) {
+        for (int i = 0; i < width * lanes; i++) acc[i] = 0;
+        for (int ky = -half; ky <= half; ky++) {
+            int img_y = y + ky;
+            if (img_y < 0) img_y = 0;
+            if (img_y >= data->height) img_y = data->height - 1;
+            for (int kx = -half; kx <= half; kx++) {
+                float w = data->kernel[(ky + half) * data->kernel_size + (kx + half)];
+                for (int x = 0; x < width; x++) {
+                    int img_x = x + kx;
+                    if (img_x < 0) img_x = 0;
+                    if (img_x >= width) img_x = width - 1;
+                    unsigned char *src = data->input + ((size_t)img_y * width + img_x) * lanes;
+                    float *dst = acc + (size_t)x * lanes;
+                    for (int i = 0; i < lanes; i++) dst[i] += src[i] * w;
+                }
+            }
+        }
+        unsigned char *out = data->output + (size_t)y * width * lanes;
+        for (int i = 0; i < width * lanes; i++) out[i] = (unsigned char)(fmax(0, fmin(255, acc[i])));
+    }
+
+    free(acc);
+}
+
+static void convolve_unit(batch_job_t *job, batch_unit_t *unit, int start_row, int end_row) {
+    (void)job;
+    if (unit->lanes == 1) apply_convolution_rows(&unit->data, start_row, end_row);
+    else convolve_lanes(&unit->data, start_row, end_row);
+}
+
+static void pack_rows(void *arg, int start_row, int end_row) {
+    for_unit_rows((batch_job_t *)arg, start_row, end_row, pack_unit);
+}
+
+static void convolve_rows(void *arg, int start_row, int end_row) {
+    for_unit_rows((batch_job_t *)arg, start_row, end_row, convolve_unit);
+}
+
+static void unpack_rows(void *arg, int start_row, int end_row) {
+    for_unit_rows((batch_job_t *)arg, start_row, end_row, unpack_unit);
+}
+
+// Outputs are written under a temporary name and renamed into place, so an interrupted run never
+// leaves a truncated file behind
+// Returns: 1 if the output is in place, 0 if it couldn't be written
+static int finish_output(batch_image_t *image, const char *path, const char *partial, int ok) {
+    struct stat st;
+    if (!ok || rename(partial, path) != 0) {
+        printf("Error writing %s\n", path);
+        remove(partial);
+        return 0;
+    }
+    if (stat(path, &st) == 0) image->written = st.st_size;
+    return 1;
+}
+
+// Each thread encodes its images one after another, so the encoder's buffers come back out of
+// the thread's scratch cache instead of being allocated per image
+static void encode_images(void *arg, int start, int end) {
+    batch_job_t *job = (batch_job_t *)arg;
+    char path[4096], partial[4200];
+
+    for (int i = start; i < end; i++) {
+        batch_image_t *image = &job->images[i];
+        if (!image->output) continue;
+        output_path(job->config->outdir, image->path, path, sizeof(path));
+        snprintf(partial, sizeof(partial), "%s.partial", path);
+        image->failed = !finish_output(image, path, partial,
+                                       stbi_write_png(partial, image->width, image->height, image->channels,
+                                                      image->output, image->width * image->channels));
+    }
+    scratch_release();
+}
+
+static int compare_size(const void *a, const void *b, void *images) {
+    const batch_image_t *ia = &((batch_image_t *)images)[*(const int *)a];
+    const batch_image_t *ib = &((batch_image_t *)images)[*(const int *)b];
+    if (ia->width != ib->width) return ia->width - ib->width;
+    if (ia->height != ib->height) return ia->height - ib->height;
+    if (ia->channels != ib->channels) return ia->channels - ib->channels;
+    return *(const int *)a - *(const int *)b;
+}
+
+static int same_size(batch_image_t *a, batch_image_t *b) {
+    return a->width == b->width && a->height == b->height && a->channels == b->channels;
+}
+
+// Convolves every decoded image of a micro-batch with one pass over a single row stream
+static void convolve_batch(batch_job_t *job, int count) {
+    int loaded = 0;
+    for (int i = 0; i < count; i++) {
+        if (job->images[i].pixels) job->order[loaded++] = i;
+    }
+    qsort_r(job->order, loaded, sizeof(int), compare_size, job->images);
+
+    int rows = 0;
+    job->num_units = 0;
+    for (int i = 0; i < loaded; ) {
+        batch_image_t *image = &job->images[job->order[i]];
+        int lanes = 1;
+        while (lanes < BATCH_LANES && i + lanes < loaded && same_size(image, &job->images[job->order[i + lanes]])) lanes++;
+
+        batch_unit_t *unit = &job->units[job->num_units++];
+        unit->first = i;
+        unit->lanes = lanes;
+        unit->start_row = rows;
+        unit->data.width = image->width;
+        unit->data.height = image->height;
+        unit->data.channels = image->channels * lanes;
+        unit->data.kernel = job->config->kernel;
+        unit->data.kernel_size = job->config->kernel_size;
+        if (lanes == 1) {
+            unit->data.input = image->pixels;
+            unit->data.output = image->output;
+        } else {
+            size_t bytes = (size_t)image->width * image->height * image->channels * lanes;
+            unit->data.input = malloc(bytes);
+            unit->data.output = malloc(bytes);
+        }
+        rows += image->height;
+        i += lanes;
+    }
+
+    parallel_rows(rows, pack_rows, job);
+    parallel_rows(rows, convolve_rows, job);
+    parallel_rows(rows, unpack_rows, job);
+
+    for (int u = 0; u < job->num_units; u++) {
+        if (job->units[u].lanes == 1) continue;
+        free(job->units[u].data.input);
+        free(job->units[u].data.output);
+    }
+}
+
+//run_batch: Filters every input, grouping them into micro-batches of up to BATCH_PIXELS decoded pixels.
+//           Each micro-batch is decoded, filtered and encoded with one dispatch to the thread pool per
+//           stage instead of one per image.  With plans, a micro-batch only grows while the estimated
+//           peaks of its jobs fit the budget together; out-of-core jobs run alone and rejected ones are
+//           never decoded.
+//           With a manifest, inputs whose output an earlier run completed are skipped, .partial files an
+//           interrupted run left are removed, and each finished micro-batch is appended to the manifest
+//           with a single fsync.
+//Returns: The number of inputs that could not be loaded, filtered or written
+int run_batch(char **inputs, int count, batch_config_t *config) {
+    batch_image_t *images = malloc(BATCH_MAX_IMAGES * sizeof(batch_image_t));
+    batch_job_t job;
+    char path[4096];
+    int failed = 0, skipped = 0;
+
+    job.config = config;
+    job.images = images;
+    job.order = malloc(BATCH_MAX_IMAGES * sizeof(int));
+    job.units = malloc(BATCH_MAX_IMAGES * sizeof(batch_unit_t));
+
+    // A run killed mid-write leaves its temporary outputs behind; a resumed run clears them
+    if (config->manifest) {
+        char partial[4200];
+        int removed = 0;
+        for (int i = 0; i < count; i++) {
+            output_path(config->outdir, inputs[i], path, sizeof(path));
+            snprintf(partial, sizeof(partial), "%s.partial", path);
+            if (remove(partial) == 0) removed++;
+        }
+        if (removed) printf("Removed %d partial outputs left by an interrupted run\n", removed);
+    }
+
+    for (int next = 0; next < count; ) {
+        // Size the micro-batch from the image headers, without decoding anything
+        int n = 0;
+        long pixels = 0;
+        size_t admitted = 0;
+        while (next + n < count && n < BATCH_MAX_IMAGES && (n == 0 || pixels < BATCH_PIXELS)) {
+            int w = 0, h = 0, c = 0;
+            images[n].mode = PLAN_FULL;
+            if (config->plans) {
+                job_plan_t *plan = &config->plans[next + n];
+                if (n > 0 && (plan->mode != PLAN_FULL || admitted + plan->peak_bytes > config->budget)) break;
+                images[n].mode = plan->mode;
+                admitted += plan->peak_bytes;
+                w = plan->width;
+                h = plan->height;
+            } else {
+                stbi_info(inputs[next + n], &w, &h, &c);
+            }
+            pixels += (long)w * h;
+            images[n].path = inputs[next + n];
+            n++;
+            if (images[0].mode != PLAN_FULL) break;
+        }
+
+        parallel_rows(n, decode_images, &job);
+        for (int i = 0; i < n; i++) {
+            if (images[i].skipped) {
+                skipped++;
+            } else if (images[i].mode == PLAN_REJECT) {
+                printf("Skipping %s, it needs about %.0f MB and the budget is %.0f MB\n", images[i].path,
+                       config->plans[next + i].peak_bytes / 1048576.0, config->budget / 1048576.0);
+                failed++;
+            } else if (!images[i].pixels) {
+                printf("Error loading image %s\n", images[i].path);
+                failed++;
+            }
+        }
+
+        if (images[0].mode == PLAN_OUT_OF_CORE) {
+            if (images[0].pixels) {
+                char partial[4200];
+                output_path(config->outdir, images[0].path, path, sizeof(path));
+                snprintf(partial, sizeof(partial), "%s.partial", path);
+                images[0].failed = !finish_output(&images[0], path, partial,
+                                                  config->tiled(config->filter_ctx, images[0].pixels,
+                                                                images[0].width, images[0].height,
+                                                                images[0].channels, partial));
+                images[0].pixels = NULL;
+            }
+        } else if (config->kernel) {
+            convolve_batch(&job, n);
+        } else {
+            for (int i = 0; i < n; i++) {
+                if (!images[i].pixels) continue;
+                if (!config->filter(config->filter_ctx, images[i].pixels, images[i].output,
+                                    images[i].width, images[i].height, images[i].channels)) {
+                    // Nothing is encoded for it, so a rerun tries it again
+                    printf("Error filtering %s\n", images[i].path);
+                    free(images[i].output);
+                    images[i].output = NULL;
+                    failed++;
+                }
+            }
+        }
+
+        parallel_rows(n, encode_images, &job);
+        for (int i = 0; i < n; i++) failed += images[i].failed;
+        if (config->manifest) {
+            for (int i = 0; i < n; i++) {
+                if (!images[i].written) continue;
+                output_path(config->outdir, images[i].path, path, sizeof(path));
+                manifest_append(config->manifest, images[i].hash, path, images[i].written);
+            }
+            manifest_sync(config->manifest);
+        }
+        for (int i = 0; i < n; i++) {
+            stbi_image_free(images[i].pixels);
+            free(images[i].output);
+        }
+        next += n;
+    }
+    if (skipped) printf("Skipped %d inputs completed by an earlier run\n", skipped);
+
+    free(images);
+    free(job.order);
+    free(job.units);
+    return failed;
+}
+
+//read_batch_list: Reads input paths from a text file, one per line; blank lines are skipped
+//Returns: The paths, or NULL if the file can't be read.  Release with free_batch_list.
+char **read_batch_list(const char *list_file, int *count) {
+    FILE *f = fopen(list_file, "r");
+    if (!f) return NULL;
+
+    int capacity = 64;
+    char **paths = malloc(capacity * sizeof(char *));
+    char line[4096];
+    *count = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (!line[0]) continue;
+        if (*count == capacity) {
+            capacity *= 2;
+            paths = realloc(paths, capacity * sizeof(char *));
+        }
+        paths[(*count)++] = strdup(line);
+    }
+    fclose(f);
+    return paths;
+}
+
+void free_batch_list(char **paths, int count) {
+    for (int i = 0; i < count; i++) free(paths[i]);
+    free(paths);
+}
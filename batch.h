@@ -0,0 +1,30 @@
+#ifndef ___BATCH
+#define ___BATCH
+#include "manifest.h"
+#include "plan.h"
+
+// Filters one whole image from input into output; input may be used as scratch.  Returns 1 on success.
+typedef int (*image_filter_t)(void *ctx, unsigned char *input, unsigned char *output,
+                               int width, int height, int channels);
+
+// Filters one image out of core and writes it to path as a PNG; consumes input.  Returns 1 on success.
+typedef int (*image_tiled_t)(void *ctx, unsigned char *input, int width, int height, int channels,
+                             const char *path);
+
+typedef struct {
+    float *kernel;             // set for a single dense convolution, which gets the packed fast paths
+    int kernel_size;
+    image_filter_t filter;     // used otherwise, one image at a time
+    void *filter_ctx;
+    const char *outdir;        // outputs are written as <outdir>/<input stem>_out.png
+    manifest_t *manifest;      // if set, completed outputs are recorded and skipped when rerun
+    job_plan_t *plans;         // if set, one per input: micro-batches are admitted against budget
+    size_t budget;
+    image_tiled_t tiled;       // runs PLAN_OUT_OF_CORE jobs, with filter_ctx
+} batch_config_t;
+
+char **read_batch_list(const char *list_file, int *count);
+void free_batch_list(char **paths, int count);
+int run_batch(char **inputs, int count, batch_config_t *config);
+
+#endif
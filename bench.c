@@ -0,0 +1,827 @@
+// bench.c - Benchmark harness comparing the filter backends on the same images
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "convolve.h"
+#include "pool.h"
+#include "omp_convolve.h"
+#include "omp_tasks.h"
+#include "linear.h"
+#include "iir.h"
+#include "temporal.h"
+#include "precision.h"
+#include "rapl.h"
+#include "regress.h"
+#include "scratch.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#define STBIW_MALLOC(sz) scratch_malloc(sz)
+#define STBIW_REALLOC(p, newsz) scratch_realloc(p, newsz)
+#define STBIW_FREE(p) scratch_free(p)
+#include "stb_image_write.h"
+
+#define BENCH_MAX_LIST 16
+
+// The standard suite: every kernel on every backend, over the stock photos and two synthetic sizes
+#define SUITE_IMAGES "pic1.jpg,pic2.jpg,pic3.jpg,pic4.jpg,synth:512x512,synth:2048x2048"
+#define SUITE_FILTERS "edge,sharpen,blur,gaussian,emboss"
+#define SUITE_BACKENDS "pthreads,openmp,omptasks,linear"
+
+#define TEMPORAL_ITERATIONS 16      // passes the temporal benchmark repeats each kernel
+#define PRECISION_CHAIN "blur,gaussian,sharpen,blur,sharpen"
+
+typedef void (*backend_fn_t)(unsigned char *input, unsigned char *output, int width, int height,
+                             int channels, float *kernel, int kernel_size);
+
+typedef struct {
+    const char *name;
+    backend_fn_t run;
+} backend_t;
+
+backend_t backends[] = {
+    {"pthreads", apply_filter},
+    {"openmp", apply_filter_omp},
+    {"omptasks", apply_filter_omp_tasks},
+    {"linear", apply_filter_linear},
+};
+#define NUM_BACKENDS (int)(sizeof(backends) / sizeof(backends[0]))
+
+typedef struct {
+    char name[64];
+    unsigned char *pixels;
+    int width;
+    int height;
+    int channels;
+} bench_image_t;
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Loads an image file, or generates one for a spec of the form synth:<width>x<height>.
+// Synthetic images are deterministic gradients plus noise, so runs are comparable across machines.
+int load_bench_image(const char *spec, bench_image_t *image) {
+    snprintf(image->name, sizeof(image->name), "%s", spec);
+    if (strncmp(spec, "synth:", 6) == 0) {
+        if (sscanf(spec + 6, "%dx%d", &image->width, &image->height) != 2 || image->width < 1 || image->height < 1) {
+            return -1;
+        }
+        image->channels = 3;
+        image->pixels = malloc((size_t)image->width * image->height * 3);
+        unsigned int state = 2463534242u;
+        for (size_t p = 0; p < (size_t)image->width * image->height; p++) {
+            int x = p % image->width, y = p / image->width;
+            for (int c = 0; c < 3; c++) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                image->pixels[p * 3 + c] = (unsigned char)(((x + y * (c + 1)) & 0xff) / 2 + (state & 0x7f));
+            }
+        }
+        return 0;
+    }
+    image->pixels = stbi_load(spec, &image->width, &image->height, &image->channels, 0);
+    return image->pixels ? 0 : -1;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+double median(double *values, int n) {
+    double sorted[REGRESS_MAX_RUNS];
+    memcpy(sorted, values, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), compare_doubles);
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+// Times runs calls of the backend after one warm-up call, sampling RAPL around each when available.
+// A run whose counters couldn't be read gets joules of -1.
+void measure(backend_t *backend, bench_image_t *image, unsigned char *output, float *kernel,
+             int runs, rapl_t *rapl, bench_result_t *samples) {
+    unsigned long long before[RAPL_MAX_ZONES], after[RAPL_MAX_ZONES];
+
+    backend->run(image->pixels, output, image->width, image->height, image->channels, kernel, 3);
+    samples->runs = runs;
+    for (int r = 0; r < runs; r++) {
+        int have_energy = rapl->count && rapl_read(rapl, before) == 0;
+        double start = now_seconds();
+        backend->run(image->pixels, output, image->width, image->height, image->channels, kernel, 3);
+        samples->seconds[r] = now_seconds() - start;
+        samples->joules[r] = (have_energy && rapl_read(rapl, after) == 0) ? rapl_joules(rapl, before, after) : -1;
+    }
+}
+
+// Splits a comma separated list in place
+int split_list(char *list, char **items) {
+    int n = 0;
+    for (char *item = strtok(list, ","); item != NULL && n < BENCH_MAX_LIST; item = strtok(NULL, ",")) {
+        items[n++] = item;
+    }
+    return n;
+}
+
+backend_t *lookup_backend(const char *name) {
+    for (int i = 0; i < NUM_BACKENDS; i++) {
+        if (strcmp(backends[i].name, name) == 0) return &backends[i];
+    }
+    return NULL;
+}
+
+// Runs every image x filter x backend combination, printing a table row for each as it finishes
+// Returns: The number of results written to results
+int run_suite(char *images_arg, char *filters_arg, char *backends_arg, int runs, bench_result_t *results) {
+    char *image_names[BENCH_MAX_LIST], *filter_names[BENCH_MAX_LIST], *backend_names[BENCH_MAX_LIST];
+    int num_images = split_list(images_arg, image_names);
+    int num_filters = split_list(filters_arg, filter_names);
+    int num_backends = split_list(backends_arg, backend_names);
+    int count = 0;
+
+    for (int f = 0; f < num_filters; f++) {
+        if (!lookup_kernel(filter_names[f])) {
+            printf("Unknown filter type: %s\n", filter_names[f]);
+            return -1;
+        }
+    }
+    for (int b = 0; b < num_backends; b++) {
+        if (!lookup_backend(backend_names[b])) {
+            printf("Unknown backend: %s\n", backend_names[b]);
+            return -1;
+        }
+    }
+
+    rapl_t rapl;
+    if (rapl_open(&rapl) == 0) {
+        printf("RAPL energy counters not readable (%s); energy columns skipped\n", rapl.reason);
+    }
+
+    printf("%-20s %-9s %-9s %10s %9s", "image", "filter", "backend", "median ms", "MP/s");
+    if (rapl.count) printf(" %9s %8s %8s", "J/frame", "avg W", "J/MP");
+    printf("\n");
+
+    for (int i = 0; i < num_images; i++) {
+        bench_image_t image;
+        if (load_bench_image(image_names[i], &image) != 0) {
+            printf("Error loading image %s\n", image_names[i]);
+            continue;
+        }
+        unsigned char *output = malloc((size_t)image.width * image.height * image.channels);
+        double megapixels = (double)image.width * image.height / 1e6;
+
+        for (int f = 0; f < num_filters; f++) {
+            for (int b = 0; b < num_backends; b++) {
+                bench_result_t *result = &results[count++];
+                snprintf(result->image, sizeof(result->image), "%s", image.name);
+                snprintf(result->filter, sizeof(result->filter), "%s", filter_names[f]);
+                snprintf(result->backend, sizeof(result->backend), "%s", backend_names[b]);
+                measure(lookup_backend(backend_names[b]), &image, output, lookup_kernel(filter_names[f]),
+                        runs, &rapl, result);
+
+                double seconds = median(result->seconds, runs);
+                printf("%-20s %-9s %-9s %10.2f %9.1f", image.name, filter_names[f], backend_names[b],
+                       seconds * 1e3, megapixels / seconds);
+                if (rapl.count) {
+                    // Only runs with an energy reading count
+                    double joules = 0, total_seconds = 0;
+                    int measured = 0;
+                    for (int r = 0; r < runs; r++) {
+                        if (result->joules[r] < 0) continue;
+                        joules += result->joules[r];
+                        total_seconds += result->seconds[r];
+                        measured++;
+                    }
+                    if (measured) {
+                        printf(" %9.3f %8.1f %8.4f", joules / measured, joules / total_seconds,
+                               joules / measured / megapixels);
+                    } else {
+                        printf(" %9s %8s %8s", "n/a", "n/a", "n/a");
+                    }
+                }
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+
+        free(output);
+        free(image.pixels);
+    }
+    return count;
+}
+
+// Times the pthreads backend on every image x filter with SMT off, then on.  Off gives each of the
+// NUM_THREADS workers its own core; on packs them two to a core on half as many cores.  The SMT
+// speedup is what one core delivers running two threads relative to running one: 2 * off / on,
+// so 1.0 means the sibling thread adds nothing and 2.0 that it doubles the core's throughput.
+int run_smt(char *images_arg, char *filters_arg, int runs) {
+    char *image_names[BENCH_MAX_LIST], *filter_names[BENCH_MAX_LIST];
+    int num_images = split_list(images_arg, image_names);
+    int num_filters = split_list(filters_arg, filter_names);
+    bench_result_t off, on;
+    rapl_t rapl = {0};
+
+    if (!pool_smt_available()) {
+        printf("No CPU offers this process SMT siblings; nothing to compare\n");
+        return 0;
+    }
+    for (int f = 0; f < num_filters; f++) {
+        if (!lookup_kernel(filter_names[f])) {
+            printf("Unknown filter type: %s\n", filter_names[f]);
+            return -1;
+        }
+    }
+
+    printf("%-20s %-9s %12s %12s %12s\n", "image", "filter", "SMT off ms", "SMT on ms", "SMT speedup");
+    for (int i = 0; i < num_images; i++) {
+        bench_image_t image;
+        if (load_bench_image(image_names[i], &image) != 0) {
+            printf("Error loading image %s\n", image_names[i]);
+            continue;
+        }
+        unsigned char *output = malloc((size_t)image.width * image.height * image.channels);
+
+        for (int f = 0; f < num_filters; f++) {
+            float *kernel = lookup_kernel(filter_names[f]);
+            pool_set_smt(POOL_SMT_OFF);
+            measure(lookup_backend("pthreads"), &image, output, kernel, runs, &rapl, &off);
+            pool_set_smt(POOL_SMT_ON);
+            measure(lookup_backend("pthreads"), &image, output, kernel, runs, &rapl, &on);
+            double off_seconds = median(off.seconds, runs), on_seconds = median(on.seconds, runs);
+            printf("%-20s %-9s %12.2f %12.2f %11.2fx\n", image.name, filter_names[f], off_seconds * 1e3,
+                   on_seconds * 1e3, 2 * off_seconds / on_seconds);
+            fflush(stdout);
+        }
+
+        free(output);
+        free(image.pixels);
+    }
+    return 0;
+}
+
+// The chain's passes one after another, ping-ponging between the two buffers, then the encode.
+// Returns: The PNG's size
+int filter_then_encode(backend_t *backend, bench_image_t *image, unsigned char *a, unsigned char *b,
+                       float **kernels, int num_passes) {
+    int len = 0;
+    memcpy(a, image->pixels, (size_t)image->width * image->height * image->channels);
+    for (int p = 0; p < num_passes; p++) {
+        backend->run(p % 2 ? b : a, p % 2 ? a : b, image->width, image->height, image->channels, kernels[p], 3);
+    }
+    unsigned char *png = stbi_write_png_to_mem(num_passes % 2 ? b : a, image->width * image->channels,
+                                               image->width, image->height, image->channels, &len);
+    scratch_free(png);
+    return len;
+}
+
+// Times a filter chain plus PNG encoding three ways: a pool dispatch per pass, a parallel for per
+// pass, and the OpenMP task graph where passes and encoding overlap band by band.  Each run starts
+// from the decoded image and ends with the PNG in memory.
+int run_pipeline(char *images_arg, char *chain_arg, int runs) {
+    char *image_names[BENCH_MAX_LIST], *filter_names[BENCH_MAX_LIST];
+    int num_images = split_list(images_arg, image_names);
+    int num_passes = split_list(chain_arg, filter_names);
+    float *kernels[BENCH_MAX_LIST];
+    double seconds[3][REGRESS_MAX_RUNS];
+    const char *variants[3] = {"pthreads", "omp for", "omp tasks"};
+
+    for (int p = 0; p < num_passes; p++) {
+        if (!(kernels[p] = lookup_kernel(filter_names[p]))) {
+            printf("Unknown filter type: %s\n", filter_names[p]);
+            return -1;
+        }
+    }
+
+    printf("%-20s %-10s %10s %10s\n", "image", "pipeline", "median ms", "speedup");
+    for (int i = 0; i < num_images; i++) {
+        bench_image_t image;
+        if (load_bench_image(image_names[i], &image) != 0) {
+            printf("Error loading image %s\n", image_names[i]);
+            continue;
+        }
+        size_t bytes = (size_t)image.width * image.height * image.channels;
+        unsigned char *a = malloc(bytes), *b = malloc(bytes);
+
+        for (int r = -1; r < runs; r++) {
+            for (int v = 0; v < 3; v++) {
+                double start = now_seconds();
+                if (v < 2) {
+                    filter_then_encode(lookup_backend(v == 0 ? "pthreads" : "openmp"), &image, a, b, kernels, num_passes);
+                } else {
+                    int len;
+                    memcpy(a, image.pixels, bytes);
+                    free(omp_tasks_filter_encode(a, image.width, image.height, image.channels, kernels,
+                                                 num_passes, 3, &len));
+                }
+                if (r >= 0) seconds[v][r] = now_seconds() - start;
+            }
+        }
+        double base = median(seconds[0], runs);
+        for (int v = 0; v < 3; v++) {
+            double m = median(seconds[v], runs);
+            printf("%-20s %-10s %10.2f %9.2fx\n", image.name, variants[v], m * 1e3, base / m);
+        }
+        fflush(stdout);
+
+        free(a);
+        free(b);
+        free(image.pixels);
+    }
+    return 0;
+}
+
+typedef struct {
+    bench_image_t *image;
+    float *weights;
+    int radius;
+    float *plane;
+    unsigned char *output;
+} direct_job_t;
+
+static void direct_rows(void *arg, int start_row, int end_row) {
+    direct_job_t *job = (direct_job_t *)arg;
+    int width = job->image->width, channels = job->image->channels;
+    for (int y = start_row; y < end_row; y++) {
+        unsigned char *src = job->image->pixels + (size_t)y * width * channels;
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < channels; c++) {
+                float sum = 0;
+                for (int k = -job->radius; k <= job->radius; k++) {
+                    int sx = x + k < 0 ? 0 : (x + k >= width ? width - 1 : x + k);
+                    sum += job->weights[k + job->radius] * src[sx * channels + c];
+                }
+                job->plane[((size_t)y * width + x) * channels + c] = sum;
+            }
+        }
+    }
+}
+
+static void direct_columns(void *arg, int start_row, int end_row) {
+    direct_job_t *job = (direct_job_t *)arg;
+    int height = job->image->height;
+    size_t stride = (size_t)job->image->width * job->image->channels;
+    for (int y = start_row; y < end_row; y++) {
+        for (size_t i = 0; i < stride; i++) {
+            float sum = 0;
+            for (int k = -job->radius; k <= job->radius; k++) {
+                int sy = y + k < 0 ? 0 : (y + k >= height ? height - 1 : y + k);
+                sum += job->weights[k + job->radius] * job->plane[sy * stride + i];
+            }
+            job->output[y * stride + i] = (unsigned char)fmaxf(0, fminf(255, sum + 0.5f));
+        }
+    }
+}
+
+// Separable convolution with the Gaussian sampled out to 5 sigma and the edges repeated, the exact
+// blur the recursive filter approximates, and what a blur of that sigma costs done directly
+void direct_gaussian(bench_image_t *image, float sigma, unsigned char *output) {
+    direct_job_t job = {image, NULL, (int)ceilf(5 * sigma), NULL, output};
+    job.weights = malloc((2 * job.radius + 1) * sizeof(float));
+    job.plane = malloc((size_t)image->width * image->height * image->channels * sizeof(float));
+    double total = 0;
+    for (int k = -job.radius; k <= job.radius; k++) total += exp(-(k * k) / (2.0 * sigma * sigma));
+    for (int k = -job.radius; k <= job.radius; k++) {
+        job.weights[k + job.radius] = (float)(exp(-(k * k) / (2.0 * sigma * sigma)) / total);
+    }
+    parallel_rows(image->height, direct_rows, &job);
+    parallel_rows(image->height, direct_columns, &job);
+    free(job.weights);
+    free(job.plane);
+}
+
+// Times the recursive Gaussian against direct convolution for each sigma and reports how far its
+// output is from the exact blur, in 8 bit levels
+int run_iir(char *images_arg, char *sigmas_arg, int runs) {
+    char *image_names[BENCH_MAX_LIST], *sigma_names[BENCH_MAX_LIST];
+    int num_images = split_list(images_arg, image_names);
+    int num_sigmas = split_list(sigmas_arg, sigma_names);
+    double direct_seconds[REGRESS_MAX_RUNS], iir_seconds[REGRESS_MAX_RUNS];
+
+    printf("%-20s %6s %10s %10s %9s %8s %8s %9s\n", "image", "sigma", "direct ms", "iir ms", "speedup",
+           "max err", "rms err", "differ");
+    for (int i = 0; i < num_images; i++) {
+        bench_image_t image;
+        if (load_bench_image(image_names[i], &image) != 0) {
+            printf("Error loading image %s\n", image_names[i]);
+            continue;
+        }
+        size_t samples = (size_t)image.width * image.height * image.channels;
+        unsigned char *exact = malloc(samples), *output = malloc(samples);
+
+        for (int s = 0; s < num_sigmas; s++) {
+            float sigma = atof(sigma_names[s]);
+            if (sigma < 0.5f) {
+                printf("Sigma %s is below 0.5, skipping\n", sigma_names[s]);
+                continue;
+            }
+            for (int r = -1; r < runs; r++) {
+                double start = now_seconds();
+                direct_gaussian(&image, sigma, exact);
+                double middle = now_seconds();
+                apply_gaussian_iir(image.pixels, output, image.width, image.height, image.channels, sigma);
+                if (r >= 0) {
+                    direct_seconds[r] = middle - start;
+                    iir_seconds[r] = now_seconds() - middle;
+                }
+            }
+            int max_error = 0;
+            size_t differ = 0;
+            double squares = 0;
+            for (size_t k = 0; k < samples; k++) {
+                int error = abs(output[k] - exact[k]);
+                if (error > max_error) max_error = error;
+                differ += error != 0;
+                squares += error * error;
+            }
+            double direct_ms = median(direct_seconds, runs) * 1e3, iir_ms = median(iir_seconds, runs) * 1e3;
+            printf("%-20s %6.1f %10.2f %10.2f %8.2fx %8d %8.3f %8.2f%%\n", image.name, sigma, direct_ms, iir_ms,
+                   direct_ms / iir_ms, max_error, sqrt(squares / samples), 100.0 * differ / samples);
+            fflush(stdout);
+        }
+
+        free(exact);
+        free(output);
+        free(image.pixels);
+    }
+    return 0;
+}
+
+// Times iterations passes of each kernel run pass by pass with apply_filter, as pthreads.c chains
+// them, and with apply_filter_iterated at each number of steps per tile; steps of 1 is the same row
+// kernel a whole frame at a time.  Every schedule must give the same image.
+int run_temporal(char *images_arg, char *filters_arg, char *steps_arg, int iterations, int runs) {
+    char *image_names[BENCH_MAX_LIST], *filter_names[BENCH_MAX_LIST], *step_names[BENCH_MAX_LIST];
+    int num_images = split_list(images_arg, image_names);
+    int num_filters = split_list(filters_arg, filter_names);
+    int num_steps = split_list(steps_arg, step_names);
+    double naive_seconds[REGRESS_MAX_RUNS], seconds[REGRESS_MAX_RUNS];
+
+    for (int f = 0; f < num_filters; f++) {
+        if (!lookup_kernel(filter_names[f])) {
+            printf("Unknown filter %s\n", filter_names[f]);
+            return -1;
+        }
+    }
+    printf("%d iterations\n", iterations);
+    printf("%-20s %-10s %6s %10s %11s %11s %6s\n", "image", "filter", "steps", "ms", "vs passes", "vs steps=1",
+           "same");
+    for (int i = 0; i < num_images; i++) {
+        bench_image_t image;
+        if (load_bench_image(image_names[i], &image) != 0) {
+            printf("Error loading image %s\n", image_names[i]);
+            continue;
+        }
+        size_t samples = (size_t)image.width * image.height * image.channels;
+        unsigned char *a = malloc(samples), *b = malloc(samples), *expected = malloc(samples);
+
+        for (int f = 0; f < num_filters; f++) {
+            float *kernel = lookup_kernel(filter_names[f]);
+            unsigned char *result = a;
+            for (int r = -1; r < runs; r++) {
+                memcpy(a, image.pixels, samples);
+                double start = now_seconds();
+                unsigned char *src = a, *dst = b;
+                for (int it = 0; it < iterations; it++) {
+                    apply_filter(src, dst, image.width, image.height, image.channels, kernel, 3);
+                    unsigned char *tmp = src;
+                    src = dst;
+                    dst = tmp;
+                }
+                if (r >= 0) naive_seconds[r] = now_seconds() - start;
+                result = src;
+            }
+            memcpy(expected, result, samples);
+            double naive_ms = median(naive_seconds, runs) * 1e3, single_ms = 0;
+            printf("%-20s %-10s %6s %10.2f %10.2fx %11s %6s\n", image.name, filter_names[f], "passes", naive_ms, 1.0,
+                   "", "yes");
+
+            for (int s = 0; s < num_steps; s++) {
+                int steps = atoi(step_names[s]);
+                if (steps < 1) {
+                    printf("Steps %s is below 1, skipping\n", step_names[s]);
+                    continue;
+                }
+                for (int r = -1; r < runs; r++) {
+                    memcpy(a, image.pixels, samples);
+                    double start = now_seconds();
+                    result = apply_filter_iterated(a, b, image.width, image.height, image.channels, kernel, 3,
+                                                   iterations, steps);
+                    if (r >= 0) seconds[r] = now_seconds() - start;
+                }
+                double ms = median(seconds, runs) * 1e3;
+                if (steps == 1) single_ms = ms;
+                char versus[32] = "";
+                if (single_ms > 0) snprintf(versus, sizeof(versus), "%.2fx", single_ms / ms);
+                printf("%-20s %-10s %6d %10.2f %10.2fx %11s %6s\n", image.name, filter_names[f], steps, ms,
+                       naive_ms / ms, versus, memcmp(result, expected, samples) ? "NO" : "yes");
+                fflush(stdout);
+            }
+        }
+
+        free(a);
+        free(b);
+        free(expected);
+        free(image.pixels);
+    }
+    return 0;
+}
+
+// The chain in double precision with nothing rounded until the final byte, clamped and truncated
+// like apply_filter, as the yardstick for every intermediate format
+static void reference_chain(bench_image_t *image, float **kernels, int num_passes, unsigned char *output) {
+    int width = image->width, height = image->height, channels = image->channels;
+    size_t samples = (size_t)width * height * channels;
+    double *src = malloc(samples * sizeof(double)), *dst = malloc(samples * sizeof(double));
+    for (size_t i = 0; i < samples; i++) src[i] = image->pixels[i];
+    for (int p = 0; p < num_passes; p++) {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < channels; c++) {
+                    double sum = 0;
+                    for (int ky = -1; ky <= 1; ky++) {
+                        int img_y = y + ky < 0 ? 0 : (y + ky >= height ? height - 1 : y + ky);
+                        for (int kx = -1; kx <= 1; kx++) {
+                            int img_x = x + kx < 0 ? 0 : (x + kx >= width ? width - 1 : x + kx);
+                            sum += src[((size_t)img_y * width + img_x) * channels + c] * kernels[p][(ky + 1) * 3 + kx + 1];
+                        }
+                    }
+                    dst[((size_t)y * width + x) * channels + c] = sum;
+                }
+            }
+        }
+        double *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    for (size_t i = 0; i < samples; i++) output[i] = (unsigned char)fmax(0, fmin(255, src[i]));
+    free(src);
+    free(dst);
+}
+
+// Times a chain of dense kernels with each intermediate format, reports the bytes it moves between
+// passes and how far its output is from the chain computed in double precision, in 8 bit levels
+int run_precision(char *images_arg, char *chain_arg, int runs) {
+    char *image_names[BENCH_MAX_LIST], *pass_names[BENCH_MAX_LIST];
+    int num_images = split_list(images_arg, image_names);
+    int num_passes = split_list(chain_arg, pass_names);
+    double seconds[REGRESS_MAX_RUNS];
+    float *kernels[BENCH_MAX_LIST];
+
+    for (int p = 0; p < num_passes; p++) {
+        if (!(kernels[p] = lookup_kernel(pass_names[p]))) {
+            printf("Unknown filter %s\n", pass_names[p]);
+            return -1;
+        }
+    }
+    printf("%d passes, half precision converted %s\n", num_passes,
+           precision_f16_hardware() ? "with F16C" : "in software");
+    printf("%-20s %-6s %10s %10s %10s %8s %8s %9s\n", "image", "format", "ms", "MB moved", "GB/s", "max err",
+           "rms err", "differ");
+    for (int i = 0; i < num_images; i++) {
+        bench_image_t image;
+        if (load_bench_image(image_names[i], &image) != 0) {
+            printf("Error loading image %s\n", image_names[i]);
+            continue;
+        }
+        int channels = image.channels;
+        size_t samples = (size_t)image.width * image.height * channels;
+        unsigned char *exact = malloc(samples), *output = malloc(samples);
+        float *tables[BENCH_MAX_LIST], *bands[4];
+        for (int p = 0; p < num_passes; p++) {
+            for (int c = 0; c < channels; c++) bands[c] = kernels[p];
+            tables[p] = build_band_kernel(bands, channels, 3);
+        }
+        reference_chain(&image, kernels, num_passes, exact);
+
+        for (int f = 0; f < PRECISION_FORMATS; f++) {
+            for (int r = -1; r < runs; r++) {
+                double start = now_seconds();
+                apply_chain_precision(image.pixels, output, image.width, image.height, channels, tables, 3,
+                                      num_passes, f);
+                if (r >= 0) seconds[r] = now_seconds() - start;
+            }
+            // Bytes in, every intermediate written once and read once, bytes out
+            double moved = samples * (2.0 + 2.0 * (num_passes - 1) * precision_bytes(f));
+            int max_error = 0;
+            size_t differ = 0;
+            double squares = 0;
+            for (size_t k = 0; k < samples; k++) {
+                int error = abs(output[k] - exact[k]);
+                if (error > max_error) max_error = error;
+                differ += error != 0;
+                squares += error * error;
+            }
+            double ms = median(seconds, runs) * 1e3;
+            printf("%-20s %-6s %10.2f %10.1f %10.2f %8d %8.3f %8.2f%%\n", image.name, precision_name(f), ms,
+                   moved / 1e6, moved / ms / 1e6, max_error, sqrt(squares / samples), 100.0 * differ / samples);
+            fflush(stdout);
+        }
+
+        for (int p = 0; p < num_passes; p++) free(tables[p]);
+        free(exact);
+        free(output);
+        free(image.pixels);
+    }
+    return 0;
+}
+
+// Appends name to a comma separated list unless it is already there
+void add_unique(char *list, size_t size, const char *name) {
+    size_t len = strlen(name), used = strlen(list);
+    for (const char *p = list; (p = strstr(p, name)) != NULL; p += len) {
+        if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == 0)) return;
+    }
+    if (used + len + 2 > size) return;
+    snprintf(list + used, size - used, "%s%s", used ? "," : "", name);
+}
+
+int Usage(char *program) {
+    printf("Usage: %s [run] [options]\n", program);
+    printf("       %s compare --baseline=<file> [options]\n", program);
+    printf("       %s smt [--images=<list>] [--filters=<list>] [--runs=<n>]\n", program);
+    printf("       %s pipeline [--images=<list>] [--filters=<chain>] [--runs=<n>]\n", program);
+    printf("       %s iir [--images=<list>] [--sigmas=<list>] [--runs=<n>]\n", program);
+    printf("       %s precision [--images=<list>] [--filters=<chain>] [--runs=<n>]\n", program);
+    printf("       %s temporal [--images=<list>] [--filters=<list>] [--iterations=<n>] [--steps=<list>] [--runs=<n>]\n",
+           program);
+    printf("Options: --images=<list>    images to filter; synth:<w>x<h> generates one\n");
+    printf("                            (default " SUITE_IMAGES ")\n");
+    printf("         --filters=<list>   dense kernels to run (default " SUITE_FILTERS ")\n");
+    printf("         --backends=<list>  any of " SUITE_BACKENDS " (default all)\n");
+    printf("         --runs=<n>         timed runs per combination, after one warm-up (default 5)\n");
+    printf("         --save=<file>      run: store the raw timings as a baseline JSON file\n");
+    printf("         --smt=<mode>       run/compare: pin threads with SMT off, on or auto (default unpinned)\n");
+    printf("smt times the pthreads backend with one thread per core and with two per core, and reports\n");
+    printf("how much a core's second hardware thread adds for each filter.\n");
+    printf("pipeline runs the filters as one chain followed by PNG encoding, per pass on the pthreads pool\n");
+    printf("and with an OpenMP parallel for, and as one OpenMP task graph (default chain blur,sharpen,edge).\n");
+    printf("iir times the recursive Gaussian blur against direct convolution with the Gaussian sampled out\n");
+    printf("to 5 sigma, and reports the largest and RMS difference in 8 bit levels and how many samples\n");
+    printf("differ (default images synth:1024x1024, sigmas 1,2,5,10,20,50).\n");
+    printf("temporal times repeated passes of each kernel one full frame at a time against tiles that advance\n");
+    printf("several passes while in cache, and checks they agree (default images synth:4096x4096, filters\n");
+    printf("blur,gaussian, %d iterations, steps 1,2,4,8,16).\n", TEMPORAL_ITERATIONS);
+    printf("precision runs a chain of kernels keeping u8, i16, f16 and f32 intermediates, and reports the\n");
+    printf("bytes moved and the difference from the chain in double precision (default images pic1.jpg,\n");
+    printf("synth:2048x2048, chain " PRECISION_CHAIN ").\n");
+    printf("compare runs the baseline's combinations again unless the lists are given, then tests each one\n");
+    printf("with Mann-Whitney U and exits 1 if any regressed.\n");
+    printf("         --threshold=<pct>  slowdown of the median that counts as a regression (default 5)\n");
+    printf("         --alpha=<p>        significance level (default 0.05)\n");
+    printf("         --report=<file>    write the markdown summary there instead of stdout\n");
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    char images_arg[1024] = "", filters_arg[1024] = "", backends_arg[1024] = "";
+    char *save = NULL, *baseline_path = NULL, *report = NULL;
+    double threshold = 5, alpha = 0.05;
+    int runs = 0;
+    int compare = 0;
+    int smt = 0;
+    int pipeline = 0;
+    int iir = 0;
+    char sigmas_arg[1024] = "1,2,5,10,20,50";
+    int temporal = 0;
+    int precision = 0;
+    char steps_arg[1024] = "1,2,4,8,16";
+    int iterations = TEMPORAL_ITERATIONS;
+    int first = 1;
+
+    if (argc > 1 && strcmp(argv[1], "run") == 0) first = 2;
+    if (argc > 1 && strcmp(argv[1], "smt") == 0) {
+        smt = 1;
+        first = 2;
+    }
+    if (argc > 1 && strcmp(argv[1], "pipeline") == 0) {
+        pipeline = 1;
+        first = 2;
+    }
+    if (argc > 1 && strcmp(argv[1], "iir") == 0) {
+        iir = 1;
+        first = 2;
+    }
+    if (argc > 1 && strcmp(argv[1], "precision") == 0) {
+        precision = 1;
+        first = 2;
+    }
+    if (argc > 1 && strcmp(argv[1], "temporal") == 0) {
+        temporal = 1;
+        first = 2;
+    }
+    if (argc > 1 && strcmp(argv[1], "compare") == 0) {
+        compare = 1;
+        first = 2;
+    }
+    for (int i = first; i < argc; i++) {
+        if (strncmp(argv[i], "--images=", 9) == 0) {
+            snprintf(images_arg, sizeof(images_arg), "%s", argv[i] + 9);
+        } else if (strncmp(argv[i], "--filters=", 10) == 0) {
+            snprintf(filters_arg, sizeof(filters_arg), "%s", argv[i] + 10);
+        } else if (strncmp(argv[i], "--backends=", 11) == 0) {
+            snprintf(backends_arg, sizeof(backends_arg), "%s", argv[i] + 11);
+        } else if (strncmp(argv[i], "--sigmas=", 9) == 0 && iir) {
+            snprintf(sigmas_arg, sizeof(sigmas_arg), "%s", argv[i] + 9);
+        } else if (strncmp(argv[i], "--steps=", 8) == 0 && temporal) {
+            snprintf(steps_arg, sizeof(steps_arg), "%s", argv[i] + 8);
+        } else if (strncmp(argv[i], "--iterations=", 13) == 0 && temporal) {
+            iterations = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--runs=", 7) == 0) {
+            runs = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--save=", 7) == 0) {
+            save = argv[i] + 7;
+        } else if (strncmp(argv[i], "--baseline=", 11) == 0) {
+            baseline_path = argv[i] + 11;
+        } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            threshold = atof(argv[i] + 12);
+        } else if (strncmp(argv[i], "--alpha=", 8) == 0) {
+            alpha = atof(argv[i] + 8);
+        } else if (strncmp(argv[i], "--report=", 9) == 0) {
+            report = argv[i] + 9;
+        } else if (strncmp(argv[i], "--smt=", 6) == 0 && pool_parse_smt(argv[i] + 6) >= 0) {
+            pool_set_smt(pool_parse_smt(argv[i] + 6));
+        } else {
+            return Usage(argv[0]);
+        }
+    }
+    if (compare && !baseline_path) return Usage(argv[0]);
+
+    bench_result_t *baseline = NULL;
+    int baseline_count = 0;
+    if (compare) {
+        baseline = load_results(baseline_path, &baseline_count);
+        if (!baseline || baseline_count == 0) {
+            printf("Error reading baseline %s\n", baseline_path);
+            free(baseline);
+            return 1;
+        }
+        // Rerun what the baseline measured, with as many runs as it took, unless told otherwise
+        int fill_images = !images_arg[0], fill_filters = !filters_arg[0], fill_backends = !backends_arg[0];
+        for (int i = 0; i < baseline_count; i++) {
+            if (fill_images) add_unique(images_arg, sizeof(images_arg), baseline[i].image);
+            if (fill_filters) add_unique(filters_arg, sizeof(filters_arg), baseline[i].filter);
+            if (fill_backends) add_unique(backends_arg, sizeof(backends_arg), baseline[i].backend);
+        }
+        if (runs == 0) runs = baseline[0].runs;
+    }
+    const char *default_images = SUITE_IMAGES, *default_filters = pipeline ? "blur,sharpen,edge" : SUITE_FILTERS;
+    if (iir) default_images = "synth:1024x1024";
+    if (temporal) {
+        default_images = "synth:4096x4096";
+        default_filters = "blur,gaussian";
+    }
+    if (precision) {
+        default_images = "pic1.jpg,synth:2048x2048";
+        default_filters = PRECISION_CHAIN;
+    }
+    if (!images_arg[0]) strcpy(images_arg, default_images);
+    if (!filters_arg[0]) strcpy(filters_arg, default_filters);
+    if (!backends_arg[0]) strcpy(backends_arg, SUITE_BACKENDS);
+    if (runs == 0) runs = 5;
+    if (runs < 2 && compare) runs = 2;
+    if (runs > REGRESS_MAX_RUNS) runs = REGRESS_MAX_RUNS;
+    if (smt) return run_smt(images_arg, filters_arg, runs) < 0 ? 1 : 0;
+    if (pipeline) return run_pipeline(images_arg, filters_arg, runs) < 0 ? 1 : 0;
+    if (iir) return run_iir(images_arg, sigmas_arg, runs) < 0 ? 1 : 0;
+    if (precision) return run_precision(images_arg, filters_arg, runs) < 0 ? 1 : 0;
+    if (temporal) return run_temporal(images_arg, filters_arg, steps_arg, iterations, runs) < 0 ? 1 : 0;
+
+    bench_result_t *results = malloc(BENCH_MAX_LIST * BENCH_MAX_LIST * BENCH_MAX_LIST * sizeof(bench_result_t));
+    int count = run_suite(images_arg, filters_arg, backends_arg, runs, results);
+    int status = count < 0 ? 1 : 0;
+
+    if (count > 0 && save) {
+        if (save_results(save, results, count) != 0) {
+            printf("Error writing %s\n", save);
+            status = 1;
+        } else {
+            printf("Baseline saved to %s\n", save);
+        }
+    }
+    if (count > 0 && compare) {
+        FILE *f = report ? fopen(report, "w") : stdout;
+        if (!f) {
+            printf("Error writing %s\n", report);
+            status = 1;
+        } else {
+            printf("\n");
+            int regressions = write_comparison(f, baseline_path, baseline, baseline_count, results, count,
+                                               threshold, alpha);
+            if (report) {
+                fclose(f);
+                printf("%d regressions, summary written to %s\n", regressions, report);
+            }
+            if (regressions) status = 1;
+        }
+    }
+
+    free(results);
+    free(baseline);
+    scratch_release();
+    return status;
+}
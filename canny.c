@@ -0,0 +1,278 @@
+// canny.c - Canny edge detector: smoothing, Sobel, non-maximum suppression, double threshold, hysteresis
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "canny.h"
+#include "pool.h"
+
+// Pixel classes after double thresholding
+#define CANNY_NONE 0
+#define CANNY_WEAK 1
+#define CANNY_STRONG 2
+
+typedef struct {
+    unsigned char *input;
+    unsigned char *output;
+    int width;
+    int height;
+    int channels;
+    float *weights;      // 2*radius+1 normalized Gaussian taps
+    int radius;
+    float low;
+    float high;
+    float *smooth;       // blurred luma, width*height
+    uint8_t *class;      // CANNY_NONE/WEAK/STRONG per pixel
+    int32_t *parent;     // union-find forest over edge pixels
+    int32_t *root;
+    uint8_t *strong_root;
+    uint8_t *band_top;   // per row, set if a band started there
+} canny_job_t;
+
+static float luma(canny_job_t *job, int x, int y) {
+    unsigned char *p = job->input + ((size_t)y * job->width + x) * job->channels;
+    if (job->channels < 3) return p[0];
+    return 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+}
+
+static void blur_luma_row(canny_job_t *job, int y, float *dst) {
+    for (int x = 0; x < job->width; x++) {
+        float sum = 0;
+        for (int k = -job->radius; k <= job->radius; k++) {
+            int img_x = x + k;
+            if (img_x < 0) img_x = 0;
+            if (img_x >= job->width) img_x = job->width - 1;
+            sum += luma(job, img_x, y) * job->weights[k + job->radius];
+        }
+        dst[x] = sum;
+    }
+}
+
+// Luma conversion and both Gaussian passes, using the same rolling row ring as unsharp mask
+static void smooth_rows(void *arg, int start_row, int end_row) {
+    canny_job_t *job = (canny_job_t *)arg;
+    int taps = 2 * job->radius + 1;
+    int width = job->width;
+    float *ring = malloc((size_t)taps * width * sizeof(float));
+
+    for (int k = -job->radius; k < job->radius; k++) {
+        int img_y = start_row + k;
+        if (img_y < 0) img_y = 0;
+        if (img_y >= job->height) img_y = job->height - 1;
+        blur_luma_row(job, img_y, ring + (size_t)((start_row + k + taps) % taps) * width);
+    }
+
+    for (int y = start_row; y < end_row; y++) {
+        int img_y = y + job->radius;
+        if (img_y >= job->height) img_y = job->height - 1;
+        blur_luma_row(job, img_y, ring + (size_t)((y + job->radius) % taps) * width);
+
+        float *dst = job->smooth + (size_t)y * width;
+        for (int x = 0; x < width; x++) dst[x] = 0;
+        for (int k = -job->radius; k <= job->radius; k++) {
+            float w = job->weights[k + job->radius];
+            float *row = ring + (size_t)((y + k + taps) % taps) * width;
+            for (int x = 0; x < width; x++) dst[x] += w * row[x];
+        }
+    }
+
+    free(ring);
+}
+
+// Sobel magnitude and direction (0: horizontal, 1: 45deg, 2: vertical, 3: 135deg) for one row
+static void gradient_row(canny_job_t *job, int y, float *mag, uint8_t *dir) {
+    int width = job->width;
+    int ym = y > 0 ? y - 1 : 0;
+    int yp = y < job->height - 1 ? y + 1 : job->height - 1;
+    float *r0 = job->smooth + (size_t)ym * width;
+    float *r1 = job->smooth + (size_t)y * width;
+    float *r2 = job->smooth + (size_t)yp * width;
+
+    for (int x = 0; x < width; x++) {
+        int xm = x > 0 ? x - 1 : 0;
+        int xp = x < width - 1 ? x + 1 : width - 1;
+        float gx = (r0[xp] + 2 * r1[xp] + r2[xp]) - (r0[xm] + 2 * r1[xm] + r2[xm]);
+        float gy = (r2[xm] + 2 * r2[x] + r2[xp]) - (r0[xm] + 2 * r0[x] + r0[xp]);
+        float ax = fabsf(gx), ay = fabsf(gy);
+
+        mag[x] = sqrtf(gx * gx + gy * gy);
+        if (ay <= 0.41421356f * ax) dir[x] = 0;
+        else if (ay > 2.41421356f * ax) dir[x] = 2;
+        else dir[x] = (gx * gy > 0) ? 1 : 3;
+    }
+}
+
+// Sobel, non-maximum suppression and double threshold fused over a 3 row ring of gradients,
+// then union-find over the band's edge pixels.  Unions never leave the band, so bands don't race.
+static void classify_rows(void *arg, int start_row, int end_row) {
+    canny_job_t *job = (canny_job_t *)arg;
+    int width = job->width;
+    float *mag = malloc(3 * (size_t)width * sizeof(float));
+    uint8_t *dir = malloc(3 * (size_t)width);
+
+    for (int k = -1; k < 1; k++) {
+        int img_y = start_row + k;
+        if (img_y < 0) img_y = 0;
+        gradient_row(job, img_y, mag + (size_t)((start_row + k + 3) % 3) * width,
+                     dir + (size_t)((start_row + k + 3) % 3) * width);
+    }
+
+    for (int y = start_row; y < end_row; y++) {
+        int img_y = y + 1 < job->height ? y + 1 : job->height - 1;
+        gradient_row(job, img_y, mag + (size_t)((y + 1) % 3) * width, dir + (size_t)((y + 1) % 3) * width);
+
+        float *up = mag + (size_t)((y + 2) % 3) * width;
+        float *mid = mag + (size_t)(y % 3) * width;
+        float *down = mag + (size_t)((y + 1) % 3) * width;
+        uint8_t *d = dir + (size_t)(y % 3) * width;
+        uint8_t *class = job->class + (size_t)y * width;
+
+        for (int x = 0; x < width; x++) {
+            int xm = x > 0 ? x - 1 : 0;
+            int xp = x < width - 1 ? x + 1 : width - 1;
+            float m = mid[x], n1, n2;
+
+            if (d[x] == 0)      { n1 = mid[xm];  n2 = mid[xp]; }
+            else if (d[x] == 1) { n1 = up[xm];   n2 = down[xp]; }
+            else if (d[x] == 2) { n1 = up[x];    n2 = down[x]; }
+            else                { n1 = up[xp];   n2 = down[xm]; }
+
+            if (m < job->low || m <= n1 || m < n2) class[x] = CANNY_NONE;
+            else class[x] = (m >= job->high) ? CANNY_STRONG : CANNY_WEAK;
+        }
+    }
+
+    free(mag);
+    free(dir);
+}
+
+static int32_t find_root(int32_t *parent, int32_t p) {
+    while (parent[p] != p) {
+        parent[p] = parent[parent[p]];
+        p = parent[p];
+    }
+    return p;
+}
+
+// Links the two trees, always under the smaller index so roots are stable across merges
+static void union_pixels(int32_t *parent, int32_t a, int32_t b) {
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if (a < b) parent[b] = a;
+    else if (b < a) parent[a] = b;
+}
+
+// Unions pixel (x, y) with its already visited 8-neighbours in rows >= min_row
+static void link_pixel(canny_job_t *job, int x, int y, int min_row) {
+    int width = job->width;
+    int32_t p = y * width + x;
+    if (job->class[p] == CANNY_NONE) return;
+
+    if (x > 0 && job->class[p - 1] != CANNY_NONE) union_pixels(job->parent, p, p - 1);
+    if (y - 1 < min_row) return;
+    for (int dx = -1; dx <= 1; dx++) {
+        int nx = x + dx;
+        if (nx < 0 || nx >= width) continue;
+        if (job->class[p - width + dx] != CANNY_NONE) union_pixels(job->parent, p, p - width + dx);
+    }
+}
+
+static void label_rows(void *arg, int start_row, int end_row) {
+    canny_job_t *job = (canny_job_t *)arg;
+    for (int y = start_row; y < end_row; y++) {
+        for (int x = 0; x < job->width; x++) {
+            job->parent[y * job->width + x] = y * job->width + x;
+        }
+    }
+    for (int y = start_row; y < end_row; y++) {
+        for (int x = 0; x < job->width; x++) link_pixel(job, x, y, start_row);
+    }
+    // Remember where this band started so the border merge knows which rows to stitch
+    if (start_row < end_row) job->band_top[start_row] = 1;
+}
+
+// Resolves every pixel to its final root without path compression, so reads don't race with writes
+static void resolve_rows(void *arg, int start_row, int end_row) {
+    canny_job_t *job = (canny_job_t *)arg;
+    for (int32_t p = start_row * job->width; p < end_row * job->width; p++) {
+        int32_t r = p;
+        if (job->class[p] == CANNY_NONE) continue;
+        while (job->parent[r] != r) r = job->parent[r];
+        job->root[p] = r;
+        if (job->class[p] == CANNY_STRONG) __atomic_store_n(&job->strong_root[r], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void write_rows(void *arg, int start_row, int end_row) {
+    canny_job_t *job = (canny_job_t *)arg;
+    int channels = job->channels;
+    int color = (channels == 2 || channels == 4) ? channels - 1 : channels;
+
+    for (int32_t p = start_row * job->width; p < end_row * job->width; p++) {
+        unsigned char value = (job->class[p] != CANNY_NONE && job->strong_root[job->root[p]]) ? 255 : 0;
+        for (int c = 0; c < color; c++) job->output[(size_t)p * channels + c] = value;
+        if (color < channels) job->output[(size_t)p * channels + color] = job->input[(size_t)p * channels + color];
+    }
+}
+
+//apply_canny: Writes a binary Canny edge map (255 on edges) to every color channel; alpha is copied through
+//Parameters: sigma: Gaussian smoothing applied to luma before the gradient
+//            low, high: Hysteresis thresholds on Sobel magnitude.  Pixels above high are edges, pixels
+//                       between low and high are edges only if connected to one above high
+void apply_canny(unsigned char *input, unsigned char *output, int width, int height,
+                 int channels, float sigma, float low, float high) {
+    canny_job_t job;
+    size_t pixels = (size_t)width * height;
+
+    if (sigma < 0.1f) sigma = 0.1f;
+    job.input = input;
+    job.output = output;
+    job.width = width;
+    job.height = height;
+    job.channels = channels;
+    job.radius = (int)ceilf(3 * sigma);
+    job.weights = malloc((2 * job.radius + 1) * sizeof(float));
+    job.low = low;
+    job.high = high;
+    job.smooth = malloc(pixels * sizeof(float));
+    job.class = malloc(pixels);
+    job.parent = malloc(pixels * sizeof(int32_t));
+    job.root = malloc(pixels * sizeof(int32_t));
+    job.strong_root = calloc(pixels, 1);
+    job.band_top = calloc(height, 1);
+
+    float total = 0;
+    for (int k = -job.radius; k <= job.radius; k++) {
+        job.weights[k + job.radius] = expf(-(k * k) / (2 * sigma * sigma));
+        total += job.weights[k + job.radius];
+    }
+    for (int k = 0; k < 2 * job.radius + 1; k++) job.weights[k] /= total;
+
+    parallel_rows(height, smooth_rows, &job);
+    parallel_rows(height, classify_rows, &job);
+    parallel_rows(height, label_rows, &job);
+
+    // Border merge: stitch the first row of every band to the last row of the band above it
+    for (int y = 1; y < height; y++) {
+        if (!job.band_top[y]) continue;
+        for (int x = 0; x < width; x++) {
+            int32_t p = y * width + x;
+            if (job.class[p] == CANNY_NONE) continue;
+            for (int dx = -1; dx <= 1; dx++) {
+                int nx = x + dx;
+                if (nx < 0 || nx >= width) continue;
+                if (job.class[p - width + dx] != CANNY_NONE) union_pixels(job.parent, p, p - width + dx);
+            }
+        }
+    }
+
+    parallel_rows(height, resolve_rows, &job);
+    parallel_rows(height, write_rows, &job);
+
+    free(job.weights);
+    free(job.smooth);
+    free(job.class);
+    free(job.parent);
+    free(job.root);
+    free(job.strong_root);
+    free(job.band_top);
+}
@@ -0,0 +1,7 @@
+#ifndef ___CANNY
+#define ___CANNY
+
+void apply_canny(unsigned char *input, unsigned char *output, int width, int height,
+                 int channels, float sigma, float low, float high);
+
+#endif
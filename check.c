@@ -0,0 +1,39 @@
+// check.c - Regression checks for engine bugs that once shipped.  Prints each failure and exits nonzero
+// if there were any.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clahe.h"
+
+static int failures = 0;
+
+// CLAHE on a flat image whose size isn't a multiple of the tile count.  Tile columns were once binned
+// with different bounds than their pixels were counted with, so a tile's cdf could exceed its count
+// and the LUT wrapped past 255: a 10x10 image of 250 at 3 tiles came out as 84 on the left.
+static void check_clahe_uneven_tiles(void) {
+    static const int sizes[][3] = {{10, 10, 3}, {10, 7, 3}, {13, 11, 4}, {37, 5, 8}, {100, 99, 8}};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int width = sizes[s][0], height = sizes[s][1], tiles = sizes[s][2];
+        unsigned char *input = malloc((size_t)width * height), *output = malloc((size_t)width * height);
+        memset(input, 250, (size_t)width * height);
+        apply_clahe(input, output, width, height, 1, tiles, 2.0f);
+        // Every tile holds at most 251 pixels here, so the clipped excess never reaches the bins above 250
+        for (int i = 0; i < width * height; i++) {
+            if (output[i] != 255) {
+                printf("FAIL clahe %dx%d tiles=%d: pixel (%d, %d) is %d, expected 255\n", width, height, tiles,
+                       i % width, i / width, output[i]);
+                failures++;
+                break;
+            }
+        }
+        free(input);
+        free(output);
+    }
+}
+
+int main(void) {
+    check_clahe_uneven_tiles();
+    if (failures) printf("%d check(s) failed\n", failures);
+    else printf("All checks passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+// clahe.c - Contrast limited adaptive histogram equalization on luma
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "clahe.h"
+#include "pool.h"
+
+typedef struct {
+    unsigned char *input;
+    unsigned char *output;
+    int width;
+    int height;
+    int channels;
+    int tiles_x;
+    int tiles_y;
+    float clip;
+    uint8_t *luma;       // width*height
+    uint8_t *luts;       // 256 entries per tile, row major over tiles
+    int *tile_of_x;      // tile column containing each x
+    int *left_tile;      // per x: the two tile columns interpolated between, and the
+    int *right_tile;     //        weight of the right one in 1/256ths
+    int *right_weight;
+} clahe_job_t;
+
+static uint8_t pixel_luma(unsigned char *p, int channels) {
+    if (channels < 3) return p[0];
+    return (uint8_t)((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+}
+
+// Clips the histogram at clip times the mean bin count, spreads the excess evenly over
+// all bins, and turns the result into an equalizing lookup table
+static void build_lut(unsigned int *hist, int count, float clip, uint8_t *lut) {
+    unsigned int limit = (unsigned int)(clip * count / 256);
+    if (limit < 1) limit = 1;
+
+    unsigned int excess = 0;
+    for (int v = 0; v < 256; v++) {
+        if (hist[v] > limit) {
+            excess += hist[v] - limit;
+            hist[v] = limit;
+        }
+    }
+    unsigned int share = excess / 256, remainder = excess % 256;
+    for (int v = 0; v < 256; v++) hist[v] += share + (v < (int)remainder ? 1 : 0);
+
+    unsigned int cdf = 0;
+    for (int v = 0; v < 256; v++) {
+        cdf += hist[v];
+        lut[v] = (uint8_t)(((uint64_t)cdf * 255 + count / 2) / (count ? count : 1));
+    }
+}
+
+// One task per band of tile rows.  Each tile row covers its own image rows, so the luma
+// plane and the per-tile histograms are filled without sharing anything between threads.
+static void tile_histograms(void *arg, int start_tile, int end_tile) {
+    clahe_job_t *job = (clahe_job_t *)arg;
+    unsigned int *hist = malloc((size_t)job->tiles_x * 256 * sizeof(unsigned int));
+
+    for (int ty = start_tile; ty < end_tile; ty++) {
+        int y0 = (int)((long)ty * job->height / job->tiles_y);
+        int y1 = (int)((long)(ty + 1) * job->height / job->tiles_y);
+        memset(hist, 0, (size_t)job->tiles_x * 256 * sizeof(unsigned int));
+
+        for (int y = y0; y < y1; y++) {
+            unsigned char *src = job->input + (size_t)y * job->width * job->channels;
+            uint8_t *luma = job->luma + (size_t)y * job->width;
+            for (int x = 0; x < job->width; x++) {
+                luma[x] = pixel_luma(src + x * job->channels, job->channels);
+                hist[job->tile_of_x[x] * 256 + luma[x]]++;
+            }
+        }
+
+        for (int tx = 0; tx < job->tiles_x; tx++) {
+            int x0 = (int)((long)tx * job->width / job->tiles_x);
+            int x1 = (int)((long)(tx + 1) * job->width / job->tiles_x);
+            build_lut(hist + tx * 256, (x1 - x0) * (y1 - y0), job->clip,
+                      job->luts + ((size_t)ty * job->tiles_x + tx) * 256);
+        }
+    }
+
+    free(hist);
+}
+
+// Fills the left/right tile and weight for a coordinate, interpolating between tile centers
+static void interpolation_weights(int pos, int size, int tiles, int *lo, int *hi, int *weight) {
+    float f = (pos + 0.5f) * tiles / size - 0.5f;
+    int t = (int)floorf(f);
+    float w = f - t;
+
+    if (t < 0) { t = 0; w = 0; }
+    if (t >= tiles - 1) { t = tiles - 1; w = 0; }
+    *lo = t;
+    *hi = t + 1 < tiles ? t + 1 : t;
+    *weight = (int)lrintf(w * 256);
+}
+
+// Bilinear blend of the four surrounding tile LUTs.  Column weights are precomputed and the
+// row weights are constant per row, so the inner loop is branch-free integer arithmetic.
+static void writeback_rows(void *arg, int start_row, int end_row) {
+    clahe_job_t *job = (clahe_job_t *)arg;
+    int channels = job->channels;
+    int color = (channels == 2 || channels == 4) ? channels - 1 : channels;
+
+    for (int y = start_row; y < end_row; y++) {
+        int top, bottom, wy;
+        interpolation_weights(y, job->height, job->tiles_y, &top, &bottom, &wy);
+        uint8_t *top_luts = job->luts + (size_t)top * job->tiles_x * 256;
+        uint8_t *bottom_luts = job->luts + (size_t)bottom * job->tiles_x * 256;
+        uint8_t *luma = job->luma + (size_t)y * job->width;
+        unsigned char *src = job->input + (size_t)y * job->width * channels;
+        unsigned char *out = job->output + (size_t)y * job->width * channels;
+
+        for (int x = 0; x < job->width; x++) {
+            int v = luma[x];
+            int l = job->left_tile[x] * 256 + v, r = job->right_tile[x] * 256 + v;
+            int wx = job->right_weight[x];
+            int t = (256 - wx) * top_luts[l] + wx * top_luts[r];
+            int b = (256 - wx) * bottom_luts[l] + wx * bottom_luts[r];
+            int mapped = ((256 - wy) * t + wy * b + (1 << 15)) >> 16;
+
+            if (color == 1) {
+                out[x * channels] = (unsigned char)mapped;
+            } else {
+                // Shift every color channel by the luma change to keep the hue
+                int delta = mapped - v;
+                for (int c = 0; c < color; c++) {
+                    int value = src[x * channels + c] + delta;
+                    out[x * channels + c] = (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+                }
+            }
+            if (color < channels) out[x * channels + color] = src[x * channels + color];
+        }
+    }
+}
+
+//apply_clahe: Locally equalizes contrast.  The image is split into tiles x tiles regions, each region's
+//             luma histogram is clipped and equalized, and pixels blend the four nearest region mappings.
+//Parameters: tiles: Regions per side, clamped to the image size
+//            clip: Histogram clip limit as a multiple of the mean bin count.  1.0 disables equalization,
+//                  larger values allow more contrast
+void apply_clahe(unsigned char *input, unsigned char *output, int width, int height,
+                 int channels, int tiles, float clip) {
+    clahe_job_t job;
+
+    if (tiles < 1) tiles = 1;
+    job.input = input;
+    job.output = output;
+    job.width = width;
+    job.height = height;
+    job.channels = channels;
+    job.tiles_x = tiles < width ? tiles : width;
+    job.tiles_y = tiles < height ? tiles : height;
+    job.clip = clip;
+    job.luma = malloc((size_t)width * height);
+    job.luts = malloc((size_t)job.tiles_x * job.tiles_y * 256);
+    job.tile_of_x = malloc(width * sizeof(int));
+    job.left_tile = malloc(width * sizeof(int));
+    job.right_tile = malloc(width * sizeof(int));
+    job.right_weight = malloc(width * sizeof(int));
+
+    // Tile columns take the same bounds tile_histograms counts their pixels with
+    for (int tx = 0; tx < job.tiles_x; tx++) {
+        int x0 = (int)((long)tx * width / job.tiles_x), x1 = (int)((long)(tx + 1) * width / job.tiles_x);
+        for (int x = x0; x < x1; x++) job.tile_of_x[x] = tx;
+    }
+    for (int x = 0; x < width; x++) {
+        interpolation_weights(x, width, job.tiles_x, &job.left_tile[x], &job.right_tile[x], &job.right_weight[x]);
+    }
+
+    parallel_rows(job.tiles_y, tile_histograms, &job);
+    parallel_rows(height, writeback_rows, &job);
+
+    free(job.luma);
+    free(job.luts);
+    free(job.tile_of_x);
+    free(job.left_tile);
+    free(job.right_tile);
+    free(job.right_weight);
+}
@@ -0,0 +1,7 @@
+#ifndef ___CLAHE
+#define ___CLAHE
+
+void apply_clahe(unsigned char *input, unsigned char *output, int width, int height,
+                 int channels, int tiles, float clip);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef ___CONVOLVE
+#define ___CONVOLVE
+
+typedef struct {
+    unsigned char *input;
+    unsigned char *output;
+    int width;
+    int height;
+    int channels;
+    float *kernel;
+    int kernel_size;
+} thread_data_t;
+
+// Filter kernels
+extern float edge_kernel[9];
+extern float sharpen_kernel[9];
+extern float blur_kernel[9];
+extern float gaussian_kernel[9];
+extern float emboss_kernel[9];
+extern float identity_kernel[9];
+
+float *lookup_kernel(const char *name);
+float *read_kernel(const char *path, int *kernel_size);
+void apply_convolution_rows(void *arg, int start_row, int end_row);
+void apply_filter(unsigned char *input, unsigned char *output, int width, int height,
+                  int channels, float *kernel, int kernel_size);
+
+// Per-band convolution: thread_data_t.kernel holds kernel_size*kernel_size*channels weights,
+// tap by tap with the bands innermost, as built by build_band_kernel
+float *build_band_kernel(float **kernels, int channels, int kernel_size);
+void apply_band_convolution_rows(void *arg, int start_row, int end_row);
+void apply_filter_bands(unsigned char *input, unsigned char *output, int width, int height,
+                        int channels, float **kernels, int kernel_size);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef ___IIR
+#define ___IIR
+
+#define IIR_ROWS 8          // rows the horizontal pass filters side by side
+#define IIR_STRIP 64        // samples per column strip of the vertical pass
+#define IIR_MIN_SIGMA 2.0f  // smaller sigmas are convolved directly
+
+void apply_gaussian_iir(unsigned char *input, unsigned char *output, int width, int height,
+                        int channels, float sigma);
+
+#endif
@@ -0,0 +1,276 @@
+// integral.c - Summed-area tables built with a parallel two-level prefix scan, and the filters using them
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "integral.h"
+#include "pool.h"
+
+typedef struct {
+    integral_t *table;
+    unsigned char *input;
+    uint8_t *band_top;   // per image row, set if a band started there
+    int *carry_row;      // per image row, table row to add in the last level, or -1
+    uint8_t *band_last;  // per image row, set on the last row of a band (already final)
+} scan_job_t;
+
+typedef struct {
+    integral_t *table;
+    unsigned char *input;
+    unsigned char *output;
+    int radius;
+    int offset;
+    uint8_t *luma;
+    int channels;        // of input/output; the table may be built over luma only
+} query_job_t;
+
+#define ROW(t, buf, y) ((buf) + (size_t)(y) * ((t)->width + 1) * (t)->channels)
+
+// Level one: horizontal prefix sums of every row, then a vertical prefix local to the band
+static void scan_rows(void *arg, int start_row, int end_row) {
+    scan_job_t *job = (scan_job_t *)arg;
+    integral_t *t = job->table;
+    int channels = t->channels;
+    int n = (t->width + 1) * channels;
+
+    for (int y = start_row; y < end_row; y++) {
+        unsigned char *src = job->input + (size_t)y * t->width * channels;
+        uint32_t *row = ROW(t, t->sum, y + 1);
+        uint64_t *row_sq = t->sum_sq ? ROW(t, t->sum_sq, y + 1) : NULL;
+
+        for (int c = 0; c < channels; c++) row[c] = 0;
+        for (int i = channels; i < n; i++) row[i] = row[i - channels] + src[i - channels];
+        if (row_sq) {
+            for (int c = 0; c < channels; c++) row_sq[c] = 0;
+            for (int i = channels; i < n; i++) {
+                uint32_t v = src[i - channels];
+                row_sq[i] = row_sq[i - channels] + v * v;
+            }
+        }
+
+        if (y > start_row) {
+            uint32_t *above = ROW(t, t->sum, y);
+            for (int i = 0; i < n; i++) row[i] += above[i];
+            if (row_sq) {
+                uint64_t *above_sq = ROW(t, t->sum_sq, y);
+                for (int i = 0; i < n; i++) row_sq[i] += above_sq[i];
+            }
+        }
+    }
+    if (start_row < end_row) job->band_top[start_row] = 1;
+}
+
+// Level two: add the finished last row of the previous band to every row of the band
+static void carry_rows(void *arg, int start_row, int end_row) {
+    scan_job_t *job = (scan_job_t *)arg;
+    integral_t *t = job->table;
+    int n = (t->width + 1) * t->channels;
+
+    for (int y = start_row; y < end_row; y++) {
+        if (job->carry_row[y] < 0 || job->band_last[y]) continue;
+        uint32_t *row = ROW(t, t->sum, y + 1);
+        uint32_t *carry = ROW(t, t->sum, job->carry_row[y]);
+        for (int i = 0; i < n; i++) row[i] += carry[i];
+        if (t->sum_sq) {
+            uint64_t *row_sq = ROW(t, t->sum_sq, y + 1);
+            uint64_t *carry_sq = ROW(t, t->sum_sq, job->carry_row[y]);
+            for (int i = 0; i < n; i++) row_sq[i] += carry_sq[i];
+        }
+    }
+}
+
+//integral_build: Builds the summed-area table of an image
+//Parameters: table: Receives the table; release it with integral_free
+//            squares: Nonzero to also build the table of squared samples, needed for variance
+//Returns: 0 on success, -1 if the tables couldn't be allocated
+int integral_build(integral_t *table, unsigned char *input, int width, int height, int channels, int squares) {
+    size_t entries = (size_t)(width + 1) * (height + 1) * channels;
+    scan_job_t job;
+
+    table->width = width;
+    table->height = height;
+    table->channels = channels;
+    table->sum = malloc(entries * sizeof(uint32_t));
+    table->sum_sq = squares ? malloc(entries * sizeof(uint64_t)) : NULL;
+    if (!table->sum || (squares && !table->sum_sq)) {
+        integral_free(table);
+        return -1;
+    }
+    memset(table->sum, 0, (size_t)(width + 1) * channels * sizeof(uint32_t));
+    if (squares) memset(table->sum_sq, 0, (size_t)(width + 1) * channels * sizeof(uint64_t));
+
+    job.table = table;
+    job.input = input;
+    job.band_top = calloc(height, 1);
+    job.carry_row = malloc(height * sizeof(int));
+    job.band_last = calloc(height, 1);
+
+    parallel_rows(height, scan_rows, &job);
+
+    // Finish each band's last row in order, so it can serve as the carry for the band below
+    int carry = -1;
+    for (int y = 0; y < height; y++) {
+        if (job.band_top[y] && y > 0) {
+            job.band_last[y - 1] = 1;
+            carry = y;
+        }
+        job.carry_row[y] = carry;
+    }
+    if (height > 0) job.band_last[height - 1] = 1;
+    int n = (width + 1) * channels;
+    for (int y = 0; y < height; y++) {
+        if (!job.band_last[y] || job.carry_row[y] < 0) continue;
+        uint32_t *row = ROW(table, table->sum, y + 1);
+        uint32_t *above = ROW(table, table->sum, job.carry_row[y]);
+        for (int i = 0; i < n; i++) row[i] += above[i];
+        if (squares) {
+            uint64_t *row_sq = ROW(table, table->sum_sq, y + 1);
+            uint64_t *above_sq = ROW(table, table->sum_sq, job.carry_row[y]);
+            for (int i = 0; i < n; i++) row_sq[i] += above_sq[i];
+        }
+    }
+
+    parallel_rows(height, carry_rows, &job);
+
+    free(job.band_top);
+    free(job.carry_row);
+    free(job.band_last);
+    return 0;
+}
+
+void integral_free(integral_t *table) {
+    free(table->sum);
+    free(table->sum_sq);
+    table->sum = NULL;
+    table->sum_sq = NULL;
+}
+
+//integral_sum: Sum of channel c over the rectangle [x0, x1) x [y0, y1)
+uint32_t integral_sum(integral_t *table, int x0, int y0, int x1, int y1, int c) {
+    int channels = table->channels;
+    uint32_t *top = ROW(table, table->sum, y0);
+    uint32_t *bottom = ROW(table, table->sum, y1);
+    return bottom[x1 * channels + c] - bottom[x0 * channels + c] - top[x1 * channels + c] + top[x0 * channels + c];
+}
+
+//integral_sum_sq: Sum of squared samples of channel c over the rectangle [x0, x1) x [y0, y1)
+uint64_t integral_sum_sq(integral_t *table, int x0, int y0, int x1, int y1, int c) {
+    int channels = table->channels;
+    uint64_t *top = ROW(table, table->sum_sq, y0);
+    uint64_t *bottom = ROW(table, table->sum_sq, y1);
+    return bottom[x1 * channels + c] - bottom[x0 * channels + c] - top[x1 * channels + c] + top[x0 * channels + c];
+}
+
+// Clips the (2*radius+1)^2 window around (x, y) to the image
+static void window(integral_t *t, int x, int y, int radius, int *x0, int *y0, int *x1, int *y1) {
+    *x0 = x - radius < 0 ? 0 : x - radius;
+    *y0 = y - radius < 0 ? 0 : y - radius;
+    *x1 = x + radius + 1 > t->width ? t->width : x + radius + 1;
+    *y1 = y + radius + 1 > t->height ? t->height : y + radius + 1;
+}
+
+static void box_rows(void *arg, int start_row, int end_row) {
+    query_job_t *job = (query_job_t *)arg;
+    integral_t *t = job->table;
+    int x0, y0, x1, y1;
+
+    for (int y = start_row; y < end_row; y++) {
+        for (int x = 0; x < t->width; x++) {
+            window(t, x, y, job->radius, &x0, &y0, &x1, &y1);
+            uint32_t area = (uint32_t)(x1 - x0) * (y1 - y0);
+            for (int c = 0; c < t->channels; c++) {
+                uint32_t sum = integral_sum(t, x0, y0, x1, y1, c);
+                job->output[((size_t)y * t->width + x) * t->channels + c] = (unsigned char)((sum + area / 2) / area);
+            }
+        }
+    }
+}
+
+static void variance_rows(void *arg, int start_row, int end_row) {
+    query_job_t *job = (query_job_t *)arg;
+    integral_t *t = job->table;
+    int x0, y0, x1, y1;
+
+    for (int y = start_row; y < end_row; y++) {
+        for (int x = 0; x < t->width; x++) {
+            window(t, x, y, job->radius, &x0, &y0, &x1, &y1);
+            double area = (double)(x1 - x0) * (y1 - y0);
+            for (int c = 0; c < t->channels; c++) {
+                double mean = integral_sum(t, x0, y0, x1, y1, c) / area;
+                double var = integral_sum_sq(t, x0, y0, x1, y1, c) / area - mean * mean;
+                double dev = var > 0 ? sqrt(var) : 0;
+                // Clamp result to [0, 255]
+                job->output[((size_t)y * t->width + x) * t->channels + c] = (unsigned char)(fmin(255, dev + 0.5));
+            }
+        }
+    }
+}
+
+static void luma_rows(void *arg, int start_row, int end_row) {
+    query_job_t *job = (query_job_t *)arg;
+    int width = job->table->width, channels = job->channels;
+
+    for (size_t p = (size_t)start_row * width; p < (size_t)end_row * width; p++) {
+        unsigned char *px = job->input + p * channels;
+        job->luma[p] = channels < 3 ? px[0] : (uint8_t)((77 * px[0] + 150 * px[1] + 29 * px[2] + 128) >> 8);
+    }
+}
+
+static void threshold_rows(void *arg, int start_row, int end_row) {
+    query_job_t *job = (query_job_t *)arg;
+    integral_t *t = job->table;
+    int channels = job->channels, x0, y0, x1, y1;
+    int color = (channels == 2 || channels == 4) ? channels - 1 : channels;
+
+    for (int y = start_row; y < end_row; y++) {
+        for (int x = 0; x < t->width; x++) {
+            size_t p = (size_t)y * t->width + x;
+            window(t, x, y, job->radius, &x0, &y0, &x1, &y1);
+            int64_t area = (int64_t)(x1 - x0) * (y1 - y0);
+            // luma > mean - offset, kept in integers
+            int64_t lhs = ((int64_t)job->luma[p] + job->offset) * area;
+            unsigned char value = lhs > (int64_t)integral_sum(t, x0, y0, x1, y1, 0) ? 255 : 0;
+
+            for (int c = 0; c < color; c++) job->output[p * channels + c] = value;
+            if (color < channels) job->output[p * channels + color] = job->input[p * channels + color];
+        }
+    }
+}
+
+//apply_box: Box blur over a (2*radius+1)^2 window in constant time per pixel, whatever the radius
+void apply_box(unsigned char *input, unsigned char *output, int width, int height, int channels, int radius) {
+    integral_t table;
+    if (integral_build(&table, input, width, height, channels, 0) != 0) return;
+    query_job_t job = {&table, input, output, radius, 0, NULL, channels};
+    parallel_rows(height, box_rows, &job);
+    integral_free(&table);
+}
+
+//apply_local_variance: Writes the standard deviation of each channel over a (2*radius+1)^2 window
+void apply_local_variance(unsigned char *input, unsigned char *output, int width, int height,
+                          int channels, int radius) {
+    integral_t table;
+    if (integral_build(&table, input, width, height, channels, 1) != 0) return;
+    query_job_t job = {&table, input, output, radius, 0, NULL, channels};
+    parallel_rows(height, variance_rows, &job);
+    integral_free(&table);
+}
+
+//apply_adaptive_threshold: Binarizes luma against its local mean.  A pixel is white (255 on every color
+//                          channel) when it is brighter than the (2*radius+1)^2 window mean minus offset.
+//                          Alpha is copied through.
+void apply_adaptive_threshold(unsigned char *input, unsigned char *output, int width, int height,
+                              int channels, int radius, int offset) {
+    integral_t table;
+    uint8_t *luma = malloc((size_t)width * height);
+    integral_t sizing = {NULL, NULL, width, height, 1};
+    query_job_t job = {&sizing, input, output, radius, offset, luma, channels};
+
+    parallel_rows(height, luma_rows, &job);
+    if (integral_build(&table, luma, width, height, 1, 0) == 0) {
+        job.table = &table;
+        parallel_rows(height, threshold_rows, &job);
+        integral_free(&table);
+    }
+    free(luma);
+}
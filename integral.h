@@ -0,0 +1,27 @@
+#ifndef ___INTEGRAL
+#define ___INTEGRAL
+#include <stdint.h>
+
+// Summed-area table with a zero first row and column: entry (x, y) holds the sum of every
+// sample above and left of pixel (x, y).  Sums are 32 bit and allowed to wrap; any rectangle
+// whose true sum fits in 32 bits (up to 16M pixels of 255) still comes out exact.
+typedef struct {
+    uint32_t *sum;       // (width+1)*(height+1)*channels
+    uint64_t *sum_sq;    // same layout, squared samples; NULL unless requested
+    int width;
+    int height;
+    int channels;
+} integral_t;
+
+int integral_build(integral_t *table, unsigned char *input, int width, int height, int channels, int squares);
+void integral_free(integral_t *table);
+uint32_t integral_sum(integral_t *table, int x0, int y0, int x1, int y1, int c);
+uint64_t integral_sum_sq(integral_t *table, int x0, int y0, int x1, int y1, int c);
+
+void apply_box(unsigned char *input, unsigned char *output, int width, int height, int channels, int radius);
+void apply_local_variance(unsigned char *input, unsigned char *output, int width, int height,
+                          int channels, int radius);
+void apply_adaptive_threshold(unsigned char *input, unsigned char *output, int width, int height,
+                              int channels, int radius, int offset);
+
+#endif
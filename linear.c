@@ -0,0 +1,157 @@
+// linear.c - Gamma-correct (linear-light) convolution using fixed-point lookup tables
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "linear.h"
+#include "pool.h"
+
+// sRGB byte -> linear 15-bit, and linear 15-bit -> sRGB byte.  Alpha is not gamma encoded,
+// so it gets a plain rescale in both directions instead.
+static uint16_t srgb_to_linear[256];
+static uint16_t byte_to_linear[256];
+static uint8_t linear_to_srgb[LINEAR_MAX + 1];
+static uint8_t linear_to_byte[LINEAR_MAX + 1];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+typedef struct {
+    unsigned char *input;
+    unsigned char *output;
+    uint16_t *linear;
+    int width;
+    int height;
+    int channels;
+    int stride;          // samples per padded row of linear
+    int32_t *weights;    // kernel in fixed point, scaled by 2^shift
+    int kernel_size;
+    int shift;
+} linear_job_t;
+
+static void build_tables(void) {
+    for (int i = 0; i < 256; i++) {
+        double s = i / 255.0;
+        double l = (s <= 0.04045) ? s / 12.92 : pow((s + 0.055) / 1.055, 2.4);
+        srgb_to_linear[i] = (uint16_t)lrint(l * LINEAR_MAX);
+        byte_to_linear[i] = (uint16_t)((i * LINEAR_MAX + 127) / 255);
+    }
+    for (int i = 0; i <= LINEAR_MAX; i++) {
+        double l = (double)i / LINEAR_MAX;
+        double s = (l <= 0.0031308) ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+        linear_to_srgb[i] = (uint8_t)lrint(s * 255);
+        linear_to_byte[i] = (uint8_t)((i * 255 + LINEAR_MAX / 2) / LINEAR_MAX);
+    }
+}
+
+// The last channel of gray+alpha and rgba images is alpha
+static int is_alpha(int channels, int c) {
+    return (channels == 2 && c == 1) || (channels == 4 && c == 3);
+}
+
+// Decodes rows into the linear buffer, padding each row by kernel_half replicated pixels on both sides
+static void linearize_rows(void *arg, int start_row, int end_row) {
+    linear_job_t *job = (linear_job_t *)arg;
+    int half = job->kernel_size / 2;
+    int channels = job->channels;
+
+    for (int y = start_row; y < end_row; y++) {
+        unsigned char *src = job->input + (size_t)y * job->width * channels;
+        uint16_t *row = job->linear + (size_t)y * job->stride;
+        uint16_t *dst = row + half * channels;
+
+        for (int x = 0; x < job->width; x++) {
+            for (int c = 0; c < channels; c++) {
+                int v = src[x * channels + c];
+                dst[x * channels + c] = is_alpha(channels, c) ? byte_to_linear[v] : srgb_to_linear[v];
+            }
+        }
+        // Handle borders by clamping
+        for (int x = 0; x < half; x++) {
+            memcpy(row + x * channels, dst, channels * sizeof(uint16_t));
+            memcpy(dst + (job->width + x) * channels, dst + (job->width - 1) * channels, channels * sizeof(uint16_t));
+        }
+    }
+}
+
+static void convolve_rows(void *arg, int start_row, int end_row) {
+    linear_job_t *job = (linear_job_t *)arg;
+    int half = job->kernel_size / 2;
+    int channels = job->channels;
+    int n = job->width * channels;
+    int32_t round = job->shift ? 1 << (job->shift - 1) : 0;
+    int32_t *acc = malloc(n * sizeof(int32_t));
+    uint8_t *store[4];
+
+    for (int c = 0; c < channels; c++) {
+        store[c] = is_alpha(channels, c) ? linear_to_byte : linear_to_srgb;
+    }
+
+    for (int y = start_row; y < end_row; y++) {
+        for (int i = 0; i < n; i++) acc[i] = round;
+
+        for (int ky = -half; ky <= half; ky++) {
+            int img_y = y + ky;
+            if (img_y < 0) img_y = 0;
+            if (img_y >= job->height) img_y = job->height - 1;
+            const uint16_t *row = job->linear + (size_t)img_y * job->stride;
+
+            for (int kx = -half; kx <= half; kx++) {
+                int32_t w = job->weights[(ky + half) * job->kernel_size + (kx + half)];
+                if (w == 0) continue;
+                // Padded rows make every tap a contiguous, branch-free multiply-add over the whole row
+                const uint16_t *src = row + (kx + half) * channels;
+                for (int i = 0; i < n; i++) acc[i] += w * src[i];
+            }
+        }
+
+        unsigned char *out = job->output + (size_t)y * n;
+        for (int x = 0; x < job->width; x++) {
+            for (int c = 0; c < channels; c++) {
+                int32_t v = acc[x * channels + c] >> job->shift;
+                if (v < 0) v = 0;
+                if (v > LINEAR_MAX) v = LINEAR_MAX;
+                out[x * channels + c] = store[c][v];
+            }
+        }
+    }
+
+    free(acc);
+}
+
+//apply_filter_linear: Same contract as apply_filter, but converts to linear light before convolving and
+//                     back to sRGB afterwards, so blurs don't darken edges.
+//Parameters: kernel: kernel_size*kernel_size weights, quantized here to the largest fixed-point scale
+//                    that cannot overflow a 32 bit accumulator
+void apply_filter_linear(unsigned char *input, unsigned char *output, int width, int height,
+                         int channels, float *kernel, int kernel_size) {
+    pthread_once(&tables_once, build_tables);
+
+    int taps = kernel_size * kernel_size;
+    double abs_sum = 0;
+    for (int i = 0; i < taps; i++) abs_sum += fabs(kernel[i]);
+    if (abs_sum < 1) abs_sum = 1;
+
+    int shift = 14;
+    while (shift > 0 && LINEAR_MAX * abs_sum * (1 << shift) > INT32_MAX / 2) shift--;
+
+    int32_t *weights = malloc(taps * sizeof(int32_t));
+    for (int i = 0; i < taps; i++) weights[i] = (int32_t)lrint(kernel[i] * (1 << shift));
+
+    linear_job_t job;
+    job.input = input;
+    job.output = output;
+    job.width = width;
+    job.height = height;
+    job.channels = channels;
+    job.stride = (width + 2 * (kernel_size / 2)) * channels;
+    job.linear = malloc((size_t)job.stride * height * sizeof(uint16_t));
+    job.weights = weights;
+    job.kernel_size = kernel_size;
+    job.shift = shift;
+
+    parallel_rows(height, linearize_rows, &job);
+    parallel_rows(height, convolve_rows, &job);
+
+    free(job.linear);
+    free(weights);
+}
@@ -0,0 +1,10 @@
+#ifndef ___LINEAR
+#define ___LINEAR
+
+// Linear-light samples are stored as 15-bit fixed point, 0..LINEAR_MAX
+#define LINEAR_MAX 32767
+
+void apply_filter_linear(unsigned char *input, unsigned char *output, int width, int height,
+                         int channels, float *kernel, int kernel_size);
+
+#endif
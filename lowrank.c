@@ -0,0 +1,181 @@
+// lowrank.c - Non-separable kernels as a short sum of separable passes
+//
+// Any k x k kernel is the sum of its singular value terms, each a column vector times a row
+// vector.  Keeping the r largest costs 2*r*k multiply-adds per sample against k*k for the dense
+// kernel, which pays off whenever r < k/2, and many large kernels met in practice are close to
+// rank 2 or 3.
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "lowrank.h"
+#include "pool.h"
+
+typedef struct {
+    unsigned char *input;
+    unsigned char *output;
+    int width;
+    int height;
+    int channels;
+    const lowrank_t *lowrank;
+} lowrank_job_t;
+
+// One-sided Jacobi: rotates pairs of columns of a (n x n, row major) until all are orthogonal,
+// accumulating the rotations in v.  Afterwards column i of a is sigma_i times u_i.
+static void jacobi_svd(double *a, double *v, int n) {
+    for (int i = 0; i < n * n; i++) v[i] = i % (n + 1) == 0;
+    for (int sweep = 0; sweep < 60; sweep++) {
+        double off = 0;
+        for (int p = 0; p < n - 1; p++) {
+            for (int q = p + 1; q < n; q++) {
+                double alpha = 0, beta = 0, gamma = 0;
+                for (int i = 0; i < n; i++) {
+                    alpha += a[i * n + p] * a[i * n + p];
+                    beta += a[i * n + q] * a[i * n + q];
+                    gamma += a[i * n + p] * a[i * n + q];
+                }
+                if (gamma == 0 || fabs(gamma) <= 1e-15 * sqrt(alpha * beta)) continue;
+                off = fmax(off, fabs(gamma) / sqrt(alpha * beta));
+                double zeta = (beta - alpha) / (2 * gamma);
+                double t = (zeta >= 0 ? 1 : -1) / (fabs(zeta) + sqrt(1 + zeta * zeta));
+                double c = 1 / sqrt(1 + t * t), s = c * t;
+                for (int i = 0; i < n; i++) {
+                    double ap = a[i * n + p], aq = a[i * n + q];
+                    a[i * n + p] = c * ap - s * aq;
+                    a[i * n + q] = s * ap + c * aq;
+                    double vp = v[i * n + p], vq = v[i * n + q];
+                    v[i * n + p] = c * vp - s * vq;
+                    v[i * n + q] = s * vp + c * vq;
+                }
+            }
+        }
+        if (off < 1e-12) break;
+    }
+}
+
+//lowrank_decompose: Finds the fewest separable terms whose sum is within tolerance of the kernel,
+//                   measured as the Frobenius norm of the difference relative to the kernel's
+//Returns: The rank kept
+int lowrank_decompose(const float *kernel, int kernel_size, double tolerance, lowrank_t *lowrank) {
+    int n = kernel_size;
+    double *a = malloc((size_t)n * n * sizeof(double));
+    double *v = malloc((size_t)n * n * sizeof(double));
+    double *sigma = malloc(n * sizeof(double));
+    int *order = malloc(n * sizeof(int));
+    for (int i = 0; i < n * n; i++) a[i] = kernel[i];
+    jacobi_svd(a, v, n);
+
+    double total = 0;
+    for (int j = 0; j < n; j++) {
+        sigma[j] = 0;
+        for (int i = 0; i < n; i++) sigma[j] += a[i * n + j] * a[i * n + j];
+        total += sigma[j];
+        sigma[j] = sqrt(sigma[j]);
+        order[j] = j;
+    }
+    // Largest singular value first
+    for (int i = 1; i < n; i++) {
+        for (int j = i; j > 0 && sigma[order[j]] > sigma[order[j - 1]]; j--) {
+            int tmp = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = tmp;
+        }
+    }
+
+    lowrank->kernel_size = n;
+    lowrank->full_rank = 0;
+    for (int j = 0; j < n; j++) lowrank->full_rank += sigma[j] > 1e-6 * sigma[order[0]];
+    double dropped = total;
+    lowrank->rank = 0;
+    while (lowrank->rank < lowrank->full_rank &&
+           sqrt(fmax(dropped, 0) / (total > 0 ? total : 1)) > tolerance) {
+        dropped -= sigma[order[lowrank->rank]] * sigma[order[lowrank->rank]];
+        lowrank->rank++;
+    }
+    lowrank->error = sqrt(fmax(dropped, 0) / (total > 0 ? total : 1));
+
+    lowrank->vertical = malloc((size_t)(lowrank->rank ? lowrank->rank : 1) * n * sizeof(float));
+    lowrank->horizontal = malloc((size_t)(lowrank->rank ? lowrank->rank : 1) * n * sizeof(float));
+    for (int t = 0; t < lowrank->rank; t++) {
+        int j = order[t];
+        // Column j of a is sigma_j u_j, so the singular value comes along with the vertical factor
+        for (int i = 0; i < n; i++) {
+            lowrank->vertical[t * n + i] = (float)a[i * n + j];
+            lowrank->horizontal[t * n + i] = (float)v[i * n + j];
+        }
+    }
+
+    free(a);
+    free(v);
+    free(sigma);
+    free(order);
+    return lowrank->rank;
+}
+
+// Separable passes only pay off while they need fewer taps than the dense kernel
+int lowrank_worthwhile(const lowrank_t *lowrank) {
+    return lowrank->rank * 2 * lowrank->kernel_size < lowrank->kernel_size * lowrank->kernel_size;
+}
+
+void lowrank_free(lowrank_t *lowrank) {
+    free(lowrank->vertical);
+    free(lowrank->horizontal);
+}
+
+// Each band keeps, per term, a ring of kernel_size rows filtered horizontally by that term.
+// Moving down one row filters one new source row for every term, then the vertical factors
+// combine the rings into the output row, with borders clamped as in apply_filter.
+static void lowrank_rows(void *arg, int start_row, int end_row) {
+    lowrank_job_t *job = (lowrank_job_t *)arg;
+    const lowrank_t *lr = job->lowrank;
+    int k = lr->kernel_size, half = k / 2, channels = job->channels;
+    int n = job->width * channels;
+    float *ring = malloc((size_t)lr->rank * k * n * sizeof(float));
+    float *padded = malloc((size_t)(job->width + 2 * half) * channels * sizeof(float));
+    float *sum = malloc(n * sizeof(float));
+
+    for (int yy = start_row - half; yy < end_row + half; yy++) {
+        // Horizontal pass of source row yy into every term's ring
+        int img_y = yy < 0 ? 0 : (yy >= job->height ? job->height - 1 : yy);
+        unsigned char *src = job->input + (size_t)img_y * n;
+        for (int x = -half; x < job->width + half; x++) {
+            int img_x = x < 0 ? 0 : (x >= job->width ? job->width - 1 : x);
+            for (int c = 0; c < channels; c++) padded[(x + half) * channels + c] = src[img_x * channels + c];
+        }
+        int slot = ((yy % k) + k) % k;
+        for (int t = 0; t < lr->rank; t++) {
+            const float *h = lr->horizontal + t * k;
+            float *dst = ring + ((size_t)t * k + slot) * n;
+            for (int i = 0; i < n; i++) dst[i] = 0;
+            for (int kx = 0; kx < k; kx++) {
+                float w = h[kx];
+                const float *p = padded + kx * channels;
+                for (int i = 0; i < n; i++) dst[i] += w * p[i];
+            }
+        }
+
+        // Output row once the ring holds rows y-half..y+half
+        int y = yy - half;
+        if (y < start_row) continue;
+        for (int i = 0; i < n; i++) sum[i] = 0;
+        for (int t = 0; t < lr->rank; t++) {
+            for (int ky = 0; ky < k; ky++) {
+                float w = lr->vertical[t * k + ky];
+                const float *row = ring + ((size_t)t * k + (((y - half + ky) % k) + k) % k) * n;
+                for (int i = 0; i < n; i++) sum[i] += w * row[i];
+            }
+        }
+        unsigned char *out = job->output + (size_t)y * n;
+        for (int i = 0; i < n; i++) out[i] = (unsigned char)(fmaxf(0, fminf(255, sum[i])));
+    }
+
+    free(ring);
+    free(padded);
+    free(sum);
+}
+
+//apply_filter_lowrank: Convolves with the sum of the decomposition's separable terms
+void apply_filter_lowrank(unsigned char *input, unsigned char *output, int width, int height,
+                          int channels, const lowrank_t *lowrank) {
+    lowrank_job_t job = {input, output, width, height, channels, lowrank};
+    parallel_rows(height, lowrank_rows, &job);
+}
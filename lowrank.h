@@ -0,0 +1,23 @@
+#ifndef ___LOWRANK
+#define ___LOWRANK
+
+#define LOWRANK_TOLERANCE 0.01      // default relative error allowed for the approximation
+
+// A kernel as a sum of rank separable terms, term t being vertical[t] (down the rows) times
+// horizontal[t] (across the columns), from its singular value decomposition
+typedef struct {
+    int kernel_size;
+    int rank;             // terms kept
+    int full_rank;        // terms with a nonzero singular value
+    double error;         // Frobenius norm of the dropped terms relative to the kernel's
+    float *vertical;      // rank * kernel_size, singular value folded in
+    float *horizontal;    // rank * kernel_size
+} lowrank_t;
+
+int lowrank_decompose(const float *kernel, int kernel_size, double tolerance, lowrank_t *lowrank);
+int lowrank_worthwhile(const lowrank_t *lowrank);
+void lowrank_free(lowrank_t *lowrank);
+void apply_filter_lowrank(unsigned char *input, unsigned char *output, int width, int height,
+                          int channels, const lowrank_t *lowrank);
+
+#endif
@@ -0,0 +1,121 @@
+// lz.c - Fast in-memory compressor for intermediate tiles
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+
+#define LZ_HASH_BITS 13
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_TAIL 12          // matches never start this close to the end, and the last 5 bytes are literals
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static int hash4(uint32_t v) {
+    return (int)((v * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+// Lengths of 15 or more spill into following bytes of 255s and a remainder
+static unsigned char *put_length(unsigned char *op, int length) {
+    for (length -= 15; length >= 255; length -= 255) *op++ = 255;
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+// Emits one sequence; a match length of 0 means literals only, which ends the block
+static unsigned char *put_sequence(unsigned char *op, unsigned char *end, const unsigned char *literals,
+                                   int num_literals, int offset, int match) {
+    int match_code = match ? match - LZ_MIN_MATCH : 0;
+    if (end - op < 1 + num_literals + num_literals / 255 + 1 + 2 + match_code / 255 + 1) return NULL;
+
+    unsigned char *token = op++;
+    *token = (unsigned char)((num_literals < 15 ? num_literals : 15) << 4);
+    if (num_literals >= 15) op = put_length(op, num_literals);
+    memcpy(op, literals, num_literals);
+    op += num_literals;
+    if (!match) return op;
+
+    *op++ = (unsigned char)offset;
+    *op++ = (unsigned char)(offset >> 8);
+    *token |= (unsigned char)(match_code < 15 ? match_code : 15);
+    if (match_code >= 15) op = put_length(op, match_code);
+    return op;
+}
+
+//lz_compress: Greedy single-probe hash matching.  Runs of misses widen the search step, so data that
+//             doesn't compress costs little more than a copy.
+//Returns: The compressed size, or 0 if it doesn't fit in capacity (LZ_BOUND always fits)
+int lz_compress(const unsigned char *src, int length, unsigned char *dst, int capacity) {
+    int table[1 << LZ_HASH_BITS];
+    unsigned char *op = dst, *end = dst + capacity;
+    int anchor = 0, i = 0, misses = 0;
+
+    memset(table, 0, sizeof(table));
+    while (i < length - LZ_TAIL) {
+        uint32_t seq = read32(src + i);
+        int h = hash4(seq);
+        int candidate = table[h];
+        table[h] = i;
+        if (candidate >= i || i - candidate > LZ_MAX_OFFSET || read32(src + candidate) != seq) {
+            i += 1 + (misses++ >> 6);
+            continue;
+        }
+
+        int match = LZ_MIN_MATCH;
+        while (i + match < length - 5 && src[candidate + match] == src[i + match]) match++;
+        op = put_sequence(op, end, src + anchor, i - anchor, i - candidate, match);
+        if (!op) return 0;
+        i += match;
+        anchor = i;
+        misses = 0;
+    }
+
+    op = put_sequence(op, end, src + anchor, length - anchor, 0, 0);
+    return op ? (int)(op - dst) : 0;
+}
+
+static int get_length(const unsigned char **ip, const unsigned char *end, int length) {
+    int b;
+    do {
+        if (*ip >= end) return -1;
+        b = *(*ip)++;
+        length += b;
+    } while (b == 255);
+    return length;
+}
+
+//lz_decompress: Checks every length and offset against both buffers, so corrupt input fails cleanly
+//Returns: The decompressed size, or -1 if the input is malformed or doesn't fit in capacity
+int lz_decompress(const unsigned char *src, int length, unsigned char *dst, int capacity) {
+    const unsigned char *ip = src, *end = src + length;
+    unsigned char *op = dst, *out_end = dst + capacity;
+
+    while (ip < end) {
+        int token = *ip++;
+        int num_literals = token >> 4;
+        if (num_literals == 15 && (num_literals = get_length(&ip, end, 15)) < 0) return -1;
+        if (num_literals > end - ip || num_literals > out_end - op) return -1;
+        memcpy(op, ip, num_literals);
+        op += num_literals;
+        ip += num_literals;
+        if (ip == end) break;
+
+        if (end - ip < 2) return -1;
+        int offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        int match = token & 15;
+        if (match == 15 && (match = get_length(&ip, end, 15)) < 0) return -1;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op - dst || match > out_end - op) return -1;
+
+        // Overlapping matches repeat the last offset bytes, so they copy forward one byte at a time
+        const unsigned char *from = op - offset;
+        if (offset >= match) memcpy(op, from, match);
+        else for (int k = 0; k < match; k++) op[k] = from[k];
+        op += match;
+    }
+    return (int)(op - dst);
+}
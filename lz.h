@@ -0,0 +1,11 @@
+#ifndef ___LZ
+#define ___LZ
+
+// Byte-oriented LZ77 in the style of LZ4: a token byte holding literal and match lengths, the
+// literals, then a 16 bit match offset.  Built for speed over ratio, for short-lived tiles.
+#define LZ_BOUND(length) ((length) + (length) / 255 + 16)
+
+int lz_compress(const unsigned char *src, int length, unsigned char *dst, int capacity);
+int lz_decompress(const unsigned char *src, int length, unsigned char *dst, int capacity);
+
+#endif
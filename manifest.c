@@ -0,0 +1,112 @@
+// manifest.c - Progress manifest that lets interrupted batch runs pick up where they stopped
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "manifest.h"
+
+// The last 12 bytes of every complete PNG: the empty IEND chunk and its CRC
+static const unsigned char png_trailer[12] = {0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82};
+
+//hash_bytes: 64 bit FNV-1a of a buffer, used to recognize inputs whatever their path or timestamp
+unsigned long long hash_bytes(const unsigned char *data, size_t length) {
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const manifest_entry_t *ea = (const manifest_entry_t *)a, *eb = (const manifest_entry_t *)b;
+    if (ea->hash != eb->hash) return ea->hash < eb->hash ? -1 : 1;
+    return strcmp(ea->output, eb->output);
+}
+
+//manifest_open: Loads the entries earlier runs recorded for this signature and opens the file for appending
+//Returns: 0 on success, -1 if the manifest can't be opened for writing
+int manifest_open(manifest_t *manifest, const char *path, const char *signature) {
+    char *line = NULL;     // grown by getline, so records as long as the writer makes them read back whole
+    size_t line_size = 0;
+    ssize_t len;
+    int capacity = 0;
+
+    manifest->signature = strdup(signature);
+    manifest->entries = NULL;
+    manifest->count = 0;
+    manifest->pending = 0;
+
+    FILE *f = fopen(path, "r");
+    while (f && (len = getline(&line, &line_size, f)) > 0) {
+        // A line without its newline was cut off by a crash and is ignored
+        if (line[len - 1] != '\n') continue;
+        line[len - 1] = 0;
+
+        char *hash = strtok(line, "\t"), *size = strtok(NULL, "\t");
+        char *sig = strtok(NULL, "\t"), *output = strtok(NULL, "\t");
+        if (!hash || !size || !sig || !output || strcmp(sig, signature) != 0) continue;
+
+        if (manifest->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            manifest->entries = realloc(manifest->entries, capacity * sizeof(manifest_entry_t));
+        }
+        manifest_entry_t *entry = &manifest->entries[manifest->count++];
+        entry->hash = strtoull(hash, NULL, 16);
+        entry->size = atoll(size);
+        entry->output = strdup(output);
+    }
+    if (f) fclose(f);
+    free(line);
+    qsort(manifest->entries, manifest->count, sizeof(manifest_entry_t), compare_entries);
+
+    manifest->file = fopen(path, "a");
+    return manifest->file ? 0 : -1;
+}
+
+// An output only counts as done if it still has the recorded size and ends in a PNG trailer
+static int output_intact(manifest_entry_t *entry) {
+    struct stat st;
+    unsigned char tail[12];
+    if (stat(entry->output, &st) != 0 || st.st_size != entry->size || st.st_size < 12) return 0;
+
+    FILE *f = fopen(entry->output, "rb");
+    if (!f) return 0;
+    int ok = fseek(f, -12, SEEK_END) == 0 && fread(tail, 1, 12, f) == 12 && memcmp(tail, png_trailer, 12) == 0;
+    fclose(f);
+    return ok;
+}
+
+//manifest_done: Returns nonzero if an earlier run already turned this input into output and the
+//               output is still intact.  Safe to call from several threads at once.
+int manifest_done(manifest_t *manifest, unsigned long long hash, const char *output) {
+    manifest_entry_t key = {hash, 0, (char *)output};
+    manifest_entry_t *entry = bsearch(&key, manifest->entries, manifest->count, sizeof(manifest_entry_t),
+                                      compare_entries);
+    return entry && output_intact(entry);
+}
+
+void manifest_append(manifest_t *manifest, unsigned long long hash, const char *output, long long size) {
+    fprintf(manifest->file, "%016llx\t%lld\t%s\t%s\n", hash, size, manifest->signature, output);
+    manifest->pending++;
+}
+
+//manifest_sync: Makes every appended line durable.  Called once per micro-batch rather than per image,
+//               so the fsync cost is spread over the whole batch.
+void manifest_sync(manifest_t *manifest) {
+    if (!manifest->pending) return;
+    fflush(manifest->file);
+    fsync(fileno(manifest->file));
+    manifest->pending = 0;
+}
+
+void manifest_close(manifest_t *manifest) {
+    if (manifest->file) {
+        manifest_sync(manifest);
+        fclose(manifest->file);
+    }
+    for (int i = 0; i < manifest->count; i++) free(manifest->entries[i].output);
+    free(manifest->entries);
+    free(manifest->signature);
+}
@@ -0,0 +1,30 @@
+#ifndef ___MANIFEST
+#define ___MANIFEST
+#include <stdio.h>
+#include <stddef.h>
+
+// A completed batch output: the input's content hash and the output file it produced
+typedef struct {
+    unsigned long long hash;
+    long long size;
+    char *output;
+} manifest_entry_t;
+
+// Append-only log of completed work.  Each line is "<hash>\t<size>\t<signature>\t<output>", where the
+// signature names the filter chain and options, so a rerun with different settings redoes everything.
+typedef struct {
+    FILE *file;
+    char *signature;
+    manifest_entry_t *entries;   // completed by earlier runs with this signature, sorted by hash
+    int count;
+    int pending;                 // lines appended since the last fsync
+} manifest_t;
+
+unsigned long long hash_bytes(const unsigned char *data, size_t length);
+int manifest_open(manifest_t *manifest, const char *path, const char *signature);
+int manifest_done(manifest_t *manifest, unsigned long long hash, const char *output);
+void manifest_append(manifest_t *manifest, unsigned long long hash, const char *output, long long size);
+void manifest_sync(manifest_t *manifest);
+void manifest_close(manifest_t *manifest);
+
+#endif
@@ -0,0 +1,204 @@
+// memprof.c - Allocation counting and per-stage time/RSS profiling, reported as JSON
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "memprof.h"
+#include "pool.h"
+#include "scratch.h"
+
+#define MEMPROF_MIN_STAGES 64
+
+typedef union {
+    size_t size;
+    max_align_t align;
+} memprof_header_t;
+
+typedef struct {
+    long allocs;
+    long long bytes;     // total requested
+    long long live;
+    long long peak;      // highest live since the current stage began
+} memprof_counters_t;
+
+typedef struct {
+    char name[64];
+    double seconds;
+    memprof_counters_t sources[MEM_SOURCES];  // allocs/bytes are deltas over the stage
+    long rss_kb;
+    long hwm_kb;
+} memprof_stage_t;
+
+typedef struct {
+    void *(*alloc)(size_t);
+    void *(*resize)(void *, size_t);
+    void (*release)(void *);
+} memprof_allocator_t;
+
+// The encoder keeps going through the scratch cache; counting sits on top of it
+static memprof_allocator_t allocators[MEM_SOURCES] = {
+    {malloc, realloc, free},
+    {scratch_malloc, scratch_realloc, scratch_free},
+    {malloc, realloc, free},
+};
+static const char *source_names[MEM_SOURCES] = {"stbi", "stbiw", "engine"};
+
+static memprof_counters_t counters[MEM_SOURCES];
+// Grows as stages finish: a chain run with --iterations records one stage per pass
+static memprof_stage_t *stages;
+static int num_stages, max_stages;
+static int recording;    // the current stage has a slot
+static int dropped;      // stages with nowhere to go when the table couldn't grow
+static memprof_counters_t stage_start[MEM_SOURCES];
+static double stage_start_time;
+
+static void count(int source, long long delta, int is_alloc) {
+    memprof_counters_t *c = &counters[source];
+    if (is_alloc) {
+        __atomic_add_fetch(&c->allocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&c->bytes, delta, __ATOMIC_RELAXED);
+    }
+    long long live = __atomic_add_fetch(&c->live, delta, __ATOMIC_RELAXED);
+    long long peak = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&c->peak, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void *memprof_malloc(int source, size_t size) {
+    memprof_header_t *block = allocators[source].alloc(sizeof(memprof_header_t) + size);
+    if (!block) return NULL;
+    block->size = size;
+    count(source, (long long)size, 1);
+    return block + 1;
+}
+
+void *memprof_realloc(int source, void *ptr, size_t size) {
+    if (!ptr) return memprof_malloc(source, size);
+    memprof_header_t *block = (memprof_header_t *)ptr - 1;
+    size_t old = block->size;
+    block = allocators[source].resize(block, sizeof(memprof_header_t) + size);
+    if (!block) return NULL;
+    block->size = size;
+    count(source, (long long)size - (long long)old, 1);
+    return block + 1;
+}
+
+void memprof_free(int source, void *ptr) {
+    if (!ptr) return;
+    memprof_header_t *block = (memprof_header_t *)ptr - 1;
+    count(source, -(long long)block->size, 0);
+    allocators[source].release(block);
+}
+
+// Reads a "<field>: <n> kB" line from /proc/self/status, or -1
+static long status_kb(const char *field) {
+    char line[256];
+    long value = -1;
+    size_t len = strlen(field);
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            value = atol(line + len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//memprof_stage_begin: Starts timing a stage and resets the peak counters.  Writing 5 to clear_refs
+//                     resets VmHWM, so each stage's high water mark is its own; kernels that don't
+//                     allow it just report the process-wide peak.
+void memprof_stage_begin(const char *name) {
+    if (num_stages == max_stages) {
+        int capacity = max_stages ? 2 * max_stages : MEMPROF_MIN_STAGES;
+        memprof_stage_t *grown = realloc(stages, capacity * sizeof(memprof_stage_t));
+        if (!grown) {
+            recording = 0;
+            dropped++;
+            return;
+        }
+        stages = grown;
+        max_stages = capacity;
+    }
+    recording = 1;
+    snprintf(stages[num_stages].name, sizeof(stages[num_stages].name), "%s", name);
+
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (f) {
+        fputs("5", f);
+        fclose(f);
+    }
+    for (int s = 0; s < MEM_SOURCES; s++) {
+        __atomic_store_n(&counters[s].peak, __atomic_load_n(&counters[s].live, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        stage_start[s] = counters[s];
+    }
+    stage_start_time = now_seconds();
+}
+
+void memprof_stage_end(void) {
+    if (!recording) return;
+    recording = 0;
+    memprof_stage_t *stage = &stages[num_stages++];
+
+    stage->seconds = now_seconds() - stage_start_time;
+    for (int s = 0; s < MEM_SOURCES; s++) {
+        stage->sources[s].allocs = counters[s].allocs - stage_start[s].allocs;
+        stage->sources[s].bytes = counters[s].bytes - stage_start[s].bytes;
+        stage->sources[s].live = counters[s].live;
+        stage->sources[s].peak = counters[s].peak;
+    }
+    stage->rss_kb = status_kb("VmRSS");
+    stage->hwm_kb = status_kb("VmHWM");
+}
+
+static void write_json_string(FILE *f, const char *text) {
+    fputc('"', f);
+    for (; *text; text++) {
+        if (*text == '"' || *text == '\\') fputc('\\', f);
+        if ((unsigned char)*text >= 0x20) fputc(*text, f);
+    }
+    fputc('"', f);
+}
+
+//memprof_write_json: Writes every finished stage's timing and memory use to path ("-" for stdout)
+void memprof_write_json(const char *path, const char *input, int width, int height, int channels) {
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!f) {
+        printf("Error writing %s\n", path);
+        return;
+    }
+
+    fprintf(f, "{\n  \"input\": ");
+    write_json_string(f, input);
+    fprintf(f, ",\n  \"width\": %d,\n  \"height\": %d,\n  \"channels\": %d,\n", width, height, channels);
+    // VmHWM restarts with every stage, so the run's peak is the highest any stage reached
+    long peak_kb = status_kb("VmHWM");
+    for (int i = 0; i < num_stages; i++) {
+        if (stages[i].hwm_kb > peak_kb) peak_kb = stages[i].hwm_kb;
+    }
+    fprintf(f, "  \"threads\": %d,\n  \"peak_rss_kb\": %ld,\n  \"stages\": [\n", NUM_THREADS, peak_kb);
+    for (int i = 0; i < num_stages; i++) {
+        memprof_stage_t *stage = &stages[i];
+        fprintf(f, "    {\"name\": ");
+        write_json_string(f, stage->name);
+        fprintf(f, ", \"seconds\": %.6f, \"rss_kb\": %ld, \"hwm_kb\": %ld", stage->seconds, stage->rss_kb, stage->hwm_kb);
+        for (int s = 0; s < MEM_SOURCES; s++) {
+            memprof_counters_t *c = &stage->sources[s];
+            fprintf(f, ",\n     \"%s\": {\"allocs\": %ld, \"bytes\": %lld, \"live_bytes\": %lld, \"peak_bytes\": %lld}",
+                    source_names[s], c->allocs, c->bytes, c->live, c->peak);
+        }
+        fprintf(f, "}%s\n", i + 1 < num_stages ? "," : "");
+    }
+    fprintf(f, "  ]");
+    if (dropped) fprintf(f, ",\n  \"truncated\": true,\n  \"dropped_stages\": %d", dropped);
+    fprintf(f, "\n}\n");
+    if (f != stdout) fclose(f);
+}
@@ -0,0 +1,16 @@
+#ifndef ___MEMPROF
+#define ___MEMPROF
+#include <stddef.h>
+
+// Where an allocation came from
+enum MemSources{MEM_STBI=0,MEM_STBIW=1,MEM_ENGINE=2,MEM_SOURCES=3};
+
+void *memprof_malloc(int source, size_t size);
+void *memprof_realloc(int source, void *ptr, size_t size);
+void memprof_free(int source, void *ptr);
+
+void memprof_stage_begin(const char *name);
+void memprof_stage_end(void);
+void memprof_write_json(const char *path, const char *input, int width, int height, int channels);
+
+#endif
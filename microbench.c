@@ -0,0 +1,159 @@
+// microbench.c - Per-component microbenchmarks for the convolution kernels and codec stages
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "microbench.h"
+#include "convolve.h"
+
+// image.c is the original single-threaded program; pulling it in as source gives access to
+// getPixelValue and, through its stb implementations, to the codecs' static hot functions
+#define main image_main
+#include "image.c"
+#undef main
+
+typedef struct {
+    Image image;
+    Matrix *algorithm;
+    int x;
+} pixel_state_t;
+
+typedef struct {
+    thread_data_t data;
+} rows_state_t;
+
+typedef struct {
+    unsigned char *pixels;
+    int width;
+    int height;
+    int channels;
+    int filter_type;
+    int y;
+    signed char *line;
+} png_line_state_t;
+
+typedef struct {
+    unsigned char *data;
+    int length;
+} zlib_state_t;
+
+typedef struct {
+    short coefficients[64];
+    short work[64];
+    unsigned char out[64];
+} idct_state_t;
+
+static unsigned char *synthetic_pixels(int width, int height, int channels) {
+    unsigned char *pixels = malloc((size_t)width * height * channels);
+    unsigned int state = 2463534242u;
+    for (size_t i = 0; i < (size_t)width * height * channels; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        // Smooth gradient plus a little noise, so the codecs see photo-like data
+        pixels[i] = (unsigned char)(((i / channels) % width + (i / channels) / width) / 4 + (state & 0x0f));
+    }
+    return pixels;
+}
+
+// One full row of getPixelValue calls per iteration
+static void bench_get_pixel_value(void *arg) {
+    pixel_state_t *s = (pixel_state_t *)arg;
+    uint8_t sink = 0;
+    int y = s->x++ % s->image.height;
+    for (int x = 0; x < s->image.width; x++) {
+        for (int bit = 0; bit < s->image.bpp; bit++) sink ^= getPixelValue(&s->image, x, y, bit, *s->algorithm);
+    }
+    __asm__ volatile("" : : "r"(sink));
+}
+
+// The whole image through apply_filter's inner loop on the calling thread only
+static void bench_convolution_rows(void *arg) {
+    rows_state_t *s = (rows_state_t *)arg;
+    apply_convolution_rows(&s->data, 0, s->data.height);
+}
+
+static void bench_encode_png_line(void *arg) {
+    png_line_state_t *s = (png_line_state_t *)arg;
+    stbiw__encode_png_line(s->pixels, s->width * s->channels, s->width, s->height, s->y, s->channels,
+                           s->filter_type, s->line);
+    s->y = (s->y + 1) % s->height;
+}
+
+static void bench_zlib_compress(void *arg) {
+    zlib_state_t *s = (zlib_state_t *)arg;
+    int out_len;
+    unsigned char *out = stbi_zlib_compress(s->data, s->length, &out_len, 8);
+    STBIW_FREE(out);
+}
+
+static void bench_idct(void *arg) {
+    idct_state_t *s = (idct_state_t *)arg;
+    // The IDCT works in place on its coefficients, so start every call from the same block
+    memcpy(s->work, s->coefficients, sizeof(s->work));
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+    stbi__idct_simd(s->out, 8, s->work);
+#else
+    stbi__idct_block(s->out, 8, s->work);
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    static const int sizes[] = {64, 512, 2048};
+    static const char *png_filters[] = {"none", "sub", "up", "avg", "paeth"};
+    char name[128];
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--filter=", 9) == 0) {
+            mb_filter = argv[i] + 9;
+        } else if (strncmp(argv[i], "--min-time=", 11) == 0) {
+            mb_min_time = atof(argv[i] + 11);
+        } else {
+            printf("Usage: %s [--filter=<substring>] [--min-time=<seconds>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+#ifndef MB_HAVE_TSC
+    printf("No cycle counter on this architecture; B/cycle is left out\n");
+#endif
+    mb_header();
+
+    for (int i = 0; i < 3; i++) {
+        int size = sizes[i];
+        unsigned char *pixels = synthetic_pixels(size, size, 3);
+        unsigned char *output = malloc((size_t)size * size * 3);
+
+        pixel_state_t pixel = {{pixels, size, size, 3}, &algorithms[GAUSE_BLUR], 0};
+        snprintf(name, sizeof(name), "getPixelValue/%dx%d row", size, size);
+        mb_run(name, bench_get_pixel_value, &pixel, size, size * 3.0);
+
+        rows_state_t rows = {{pixels, output, size, size, 3, gaussian_kernel, 3}};
+        snprintf(name, sizeof(name), "apply_convolution_rows/%dx%d", size, size);
+        mb_run(name, bench_convolution_rows, &rows, (double)size * size, (double)size * size * 3);
+
+        signed char *line = malloc(size * 3);
+        for (int f = 0; f < 5; f++) {
+            png_line_state_t png = {pixels, size, size, 3, f, 0, line};
+            snprintf(name, sizeof(name), "stbiw__encode_png_line/%s/%d", png_filters[f], size);
+            mb_run(name, bench_encode_png_line, &png, size, size * 3.0);
+        }
+        free(line);
+
+        // Raw pixels stand in for the PNG writer's filtered rows; both are smooth, repetitive bytes
+        zlib_state_t zlib = {pixels, size * size * 3};
+        snprintf(name, sizeof(name), "stbi_zlib_compress/%dKB", zlib.length / 1024);
+        mb_run(name, bench_zlib_compress, &zlib, 0, zlib.length);
+
+        free(pixels);
+        free(output);
+    }
+
+    idct_state_t idct;
+    for (int i = 0; i < 64; i++) idct.coefficients[i] = (short)(i < 10 ? 200 - i * 20 : (i % 7) - 3);
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+    mb_run("stbi__idct_simd/8x8 block", bench_idct, &idct, 64, 64 * 2);
+#else
+    mb_run("stbi__idct_block/8x8 block", bench_idct, &idct, 64, 64 * 2);
+#endif
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef ___MICROBENCH
+#define ___MICROBENCH
+// microbench.h - Header-only microbenchmark runner in the spirit of Google Benchmark.
+// Each benchmark is a function called in a calibrated loop; the fastest of several repetitions
+// is reported as time per call, per item (pixel, block, row...) and bytes processed per cycle.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MB_HAVE_TSC 1
+#endif
+
+#define MB_REPETITIONS 5
+
+typedef void (*mb_fn_t)(void *state);
+
+static double mb_min_time = 0.1;      // seconds each repetition runs for
+static const char *mb_filter = NULL;  // only run benchmarks whose name contains this
+
+static double mb_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned long long mb_cycles(void) {
+#ifdef MB_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void mb_header(void) {
+    printf("%-44s %12s %12s %10s %10s\n", "Benchmark", "ns/call", "iterations", "ns/item", "B/cycle");
+}
+
+//mb_run: Times fn(state).  items and bytes are the work done by one call, for the per item and
+//        bytes per cycle columns; pass 0 to leave a column out.
+static void mb_run(const char *name, mb_fn_t fn, void *state, double items, double bytes) {
+    if (mb_filter && !strstr(name, mb_filter)) return;
+
+    long iterations = 1;
+    for (;;) {
+        double start = mb_now();
+        for (long i = 0; i < iterations; i++) fn(state);
+        double elapsed = mb_now() - start;
+        if (elapsed >= mb_min_time || iterations >= (1L << 30)) break;
+        iterations = elapsed > 0 ? (long)(iterations * 1.4 * mb_min_time / elapsed) + 1 : iterations * 10;
+    }
+
+    double best = 1e30, best_cycles = 1e30;
+    for (int r = 0; r < MB_REPETITIONS; r++) {
+        unsigned long long c0 = mb_cycles();
+        double start = mb_now();
+        for (long i = 0; i < iterations; i++) fn(state);
+        double per_call = (mb_now() - start) / iterations;
+        double cycles = (double)(mb_cycles() - c0) / iterations;
+        if (per_call < best) best = per_call;
+        if (cycles < best_cycles) best_cycles = cycles;
+    }
+
+    printf("%-44s %12.1f %12ld", name, best * 1e9, iterations);
+    if (items > 0) printf(" %10.3f", best * 1e9 / items);
+    else printf(" %10s", "-");
+    if (bytes > 0 && best_cycles > 0) printf(" %10.3f", bytes / best_cycles);
+    else printf(" %10s", "-");
+    printf("\n");
+    fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,41 @@
+// omp_convolve.c - Dense kernel convolution parallelized with an OpenMP parallel for
+#include <math.h>
+#include <omp.h>
+#include "omp_convolve.h"
+
+void apply_filter_omp(unsigned char *input, unsigned char *output, int width, int height,
+                      int channels, float *kernel, int kernel_size) {
+    int kernel_half = kernel_size / 2;
+    
+    #pragma omp parallel for collapse(2) schedule(dynamic)
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < channels; c++) {
+                float sum = 0.0;
+                
+                // Apply kernel
+                for (int ky = -kernel_half; ky <= kernel_half; ky++) {
+                    for (int kx = -kernel_half; kx <= kernel_half; kx++) {
+                        int img_y = y + ky;
+                        int img_x = x + kx;
+                        
+                        // Handle borders by clamping
+                        if (img_y < 0) img_y = 0;
+                        if (img_y >= height) img_y = height - 1;
+                        if (img_x < 0) img_x = 0;
+                        if (img_x >= width) img_x = width - 1;
+                        
+                        int pixel_idx = (img_y * width + img_x) * channels + c;
+                        int kernel_idx = (ky + kernel_half) * kernel_size + (kx + kernel_half);
+                        
+                        sum += input[pixel_idx] * kernel[kernel_idx];
+                    }
+                }
+                
+                // Clamp result to [0, 255]
+                int output_idx = (y * width + x) * channels + c;
+                output[output_idx] = (unsigned char)(fmax(0, fmin(255, sum)));
+            }
+        }
+    }
+}
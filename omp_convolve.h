@@ -0,0 +1,7 @@
+#ifndef ___OMP_CONVOLVE
+#define ___OMP_CONVOLVE
+
+void apply_filter_omp(unsigned char *input, unsigned char *output, int width, int height,
+                      int channels, float *kernel, int kernel_size);
+
+#endif
@@ -0,0 +1,269 @@
+// omp_tasks.c - Decode, filter and encode as one OpenMP task graph
+//
+// Every image becomes a graph of row bands.  Filter pass p of band b depends on pass p-1 of bands
+// b-1..b+1 (its kernel halo), the PNG row filtering of band b on the last pass of bands b-1 and b
+// (the Up, Average and Paeth predictors read the previous row), and compression on every encoded
+// band.  Later passes start on the top of the image while earlier ones are still working through
+// the bottom, and encoding follows right behind.  Across images, decoding the next one overlaps
+// filtering and encoding the current one.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "omp_tasks.h"
+#include "convolve.h"
+#include "stb_image.h"
+
+// A private copy of the writer, for its PNG line filter and deflate
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+typedef struct {
+    const char *output_path;    // NULL to keep the PNG in memory
+    unsigned char *pixels;      // the decoded image, then every second pass's result
+    unsigned char *other;       // the other ping-pong buffer
+    unsigned char *filt;        // PNG filtered rows, each led by its filter type byte
+    unsigned char *png;
+    int png_len;
+    int width;
+    int height;
+    int channels;
+    float **kernels;
+    int num_passes;
+    int kernel_size;
+    int num_bands;
+    int failed;
+    // Dependence sentinels: the tasks only use their addresses
+    char decoded;
+    char written;
+    char *filtered;             // num_passes * num_bands
+    char *encoded;              // num_bands
+} omp_image_t;
+
+//apply_filter_omp_tasks: One pass as a taskloop of OMP_TASK_BAND row grains, for comparison with the
+//                        parallel for in omp_convolve.c
+void apply_filter_omp_tasks(unsigned char *input, unsigned char *output, int width, int height,
+                            int channels, float *kernel, int kernel_size) {
+    thread_data_t data = {input, output, width, height, channels, kernel, kernel_size};
+
+    #pragma omp parallel
+    #pragma omp single
+    #pragma omp taskloop grainsize(1)
+    for (int band = 0; band < (height + OMP_TASK_BAND - 1) / OMP_TASK_BAND; band++) {
+        int end = (band + 1) * OMP_TASK_BAND < height ? (band + 1) * OMP_TASK_BAND : height;
+        apply_convolution_rows(&data, band * OMP_TASK_BAND, end);
+    }
+}
+
+// PNG-filters rows [start, end) exactly as stbi_write_png_to_mem does, so the output is identical
+static void encode_rows(omp_image_t *job, unsigned char *pixels, int start, int end) {
+    int stride = job->width * job->channels;
+    signed char *line = malloc(stride);
+
+    for (int j = start; j < end; j++) {
+        int best_filter = 0, best_value = 0x7fffffff;
+        for (int filter_type = 0; filter_type < 5; filter_type++) {
+            stbiw__encode_png_line(pixels, stride, job->width, job->height, j, job->channels, filter_type, line);
+            int estimate = 0;
+            for (int i = 0; i < stride; i++) estimate += abs(line[i]);
+            if (estimate < best_value) {
+                best_value = estimate;
+                best_filter = filter_type;
+            }
+        }
+        if (best_filter != 4) {
+            stbiw__encode_png_line(pixels, stride, job->width, job->height, j, job->channels, best_filter, line);
+        }
+        job->filt[(size_t)j * (stride + 1)] = (unsigned char)best_filter;
+        memcpy(job->filt + (size_t)j * (stride + 1) + 1, line, stride);
+    }
+    free(line);
+}
+
+// Deflates the filtered rows and wraps them in PNG chunks, as stbi_write_png_to_mem does
+static void compress_png(omp_image_t *job) {
+    int ctype[5] = {-1, 0, 4, 2, 6};
+    unsigned char sig[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    int zlen;
+    unsigned char *zlib = stbi_zlib_compress(job->filt, job->height * (job->width * job->channels + 1), &zlen,
+                                             stbi_write_png_compression_level);
+    if (!zlib) {
+        job->failed = 1;
+        return;
+    }
+
+    job->png_len = 8 + 12 + 13 + 12 + zlen + 12;
+    unsigned char *o = job->png = malloc(job->png_len);
+    memcpy(o, sig, 8);
+    o += 8;
+    stbiw__wp32(o, 13);
+    stbiw__wptag(o, "IHDR");
+    stbiw__wp32(o, job->width);
+    stbiw__wp32(o, job->height);
+    *o++ = 8;
+    *o++ = STBIW_UCHAR(ctype[job->channels]);
+    *o++ = 0;
+    *o++ = 0;
+    *o++ = 0;
+    stbiw__wpcrc(&o, 13);
+    stbiw__wp32(o, zlen);
+    stbiw__wptag(o, "IDAT");
+    memcpy(o, zlib, zlen);
+    o += zlen;
+    STBIW_FREE(zlib);
+    stbiw__wpcrc(&o, zlen);
+    stbiw__wp32(o, 0);
+    stbiw__wptag(o, "IEND");
+    stbiw__wpcrc(&o, 0);
+}
+
+static void finish_image(omp_image_t *job) {
+    if (!job->failed) compress_png(job);
+    if (job->output_path && !job->failed) {
+        FILE *f = fopen(job->output_path, "wb");
+        if (!f || fwrite(job->png, 1, job->png_len, f) != (size_t)job->png_len) job->failed = 1;
+        if (f && fclose(f) != 0) job->failed = 1;
+    }
+    if (job->output_path) {
+        free(job->png);
+        job->png = NULL;
+        stbi_image_free(job->pixels);
+    }
+    free(job->other);
+    free(job->filt);
+    free(job->filtered);
+    free(job->encoded);
+}
+
+static int band_end(omp_image_t *job, int band) {
+    int end = (band + 1) * OMP_TASK_BAND;
+    return end < job->height ? end : job->height;
+}
+
+static void filter_band(omp_image_t *job, int pass, int band) {
+    if (job->failed) return;
+    unsigned char *src = pass % 2 ? job->other : job->pixels;
+    unsigned char *dst = pass % 2 ? job->pixels : job->other;
+    thread_data_t data = {src, dst, job->width, job->height, job->channels, job->kernels[pass], job->kernel_size};
+    apply_convolution_rows(&data, band * OMP_TASK_BAND, band_end(job, band));
+}
+
+// Creates the filter, encode and compress tasks of one image.  They wait on job->decoded, so the
+// pixels need not exist yet; only the dimensions must be known.
+static void spawn_image(omp_image_t *job) {
+    int nb = job->num_bands = (job->height + OMP_TASK_BAND - 1) / OMP_TASK_BAND;
+    job->filtered = malloc((size_t)job->num_passes * nb);
+    job->encoded = malloc(nb);
+
+    for (int p = 0; p < job->num_passes; p++) {
+        char *done = job->filtered + (size_t)p * nb;
+        char *previous = p > 0 ? done - nb : done;
+        // Variables named only in depend clauses look unused to GCC's -Wunused
+        (void)previous;
+        for (int b = 0; b < nb; b++) {
+            int lo = b > 0 ? b - 1 : b, hi = b < nb - 1 ? b + 1 : b;
+            (void)lo;
+            if (p == 0) {
+                #pragma omp task firstprivate(job, p, b) depend(in: job->decoded) depend(out: done[b])
+                filter_band(job, p, b);
+            } else {
+                #pragma omp task firstprivate(job, p, b) depend(iterator(k = lo:hi + 1), in: previous[k]) \
+                                 depend(out: done[b])
+                filter_band(job, p, b);
+            }
+        }
+    }
+
+    char *last = job->filtered + (size_t)(job->num_passes - 1) * nb;
+    (void)last;
+    for (int b = 0; b < nb; b++) {
+        int lo = b > 0 ? b - 1 : b;
+        (void)lo;
+        #pragma omp task firstprivate(job, b) depend(iterator(k = lo:b + 1), in: last[k]) depend(out: job->encoded[b])
+        {
+            if (!job->failed) {
+                encode_rows(job, job->num_passes % 2 ? job->other : job->pixels, b * OMP_TASK_BAND, band_end(job, b));
+            }
+        }
+    }
+
+    #pragma omp task firstprivate(job) depend(iterator(k = 0:nb), in: job->encoded[k]) depend(out: job->written)
+    finish_image(job);
+}
+
+static void init_image(omp_image_t *job, float **kernels, int num_passes, int kernel_size) {
+    memset(job, 0, sizeof(omp_image_t));
+    job->kernels = kernels;
+    job->num_passes = num_passes;
+    job->kernel_size = kernel_size;
+}
+
+static void allocate_buffers(omp_image_t *job) {
+    size_t bytes = (size_t)job->width * job->height * job->channels;
+    job->other = malloc(bytes);
+    job->filt = malloc((size_t)(job->width * job->channels + 1) * job->height);
+}
+
+//omp_tasks_filter_encode: Runs num_passes convolutions over an in-memory image and PNG-encodes the
+//                         result as one task graph.  input is overwritten by intermediate passes.
+//Returns: The PNG, to be freed with free, or NULL on failure
+unsigned char *omp_tasks_filter_encode(unsigned char *input, int width, int height, int channels,
+                                       float **kernels, int num_passes, int kernel_size, int *png_len) {
+    omp_image_t job;
+    init_image(&job, kernels, num_passes, kernel_size);
+    job.pixels = input;
+    job.width = width;
+    job.height = height;
+    job.channels = channels;
+    allocate_buffers(&job);
+
+    #pragma omp parallel
+    #pragma omp single
+    spawn_image(&job);
+
+    *png_len = job.png_len;
+    return job.failed ? NULL : job.png;
+}
+
+//omp_tasks_pipeline: Filters every input into the matching output PNG.  Images are sized from their
+//                    headers up front so their whole graphs can be created at once; decoding waits
+//                    for the image two back to be written, bounding how many are in memory.
+//Returns: The number of inputs that failed
+int omp_tasks_pipeline(char **inputs, char **outputs, int count, float **kernels, int num_passes,
+                       int kernel_size) {
+    omp_image_t *jobs = malloc(count * sizeof(omp_image_t));
+    int failed = 0;
+
+    #pragma omp parallel
+    #pragma omp single
+    for (int i = 0; i < count; i++) {
+        omp_image_t *job = &jobs[i];
+        char *before = i >= 2 ? &jobs[i - 2].written : &job->written;
+        (void)before;
+        init_image(job, kernels, num_passes, kernel_size);
+        job->output_path = outputs[i];
+        if (!stbi_info(inputs[i], &job->width, &job->height, &job->channels)) {
+            job->failed = 1;
+            continue;
+        }
+
+        #pragma omp task firstprivate(job, i) depend(in: before[0]) depend(out: job->decoded)
+        {
+            int w, h, c;
+            job->pixels = stbi_load(inputs[i], &w, &h, &c, 0);
+            if (!job->pixels || w != job->width || h != job->height || c != job->channels) job->failed = 1;
+            allocate_buffers(job);
+        }
+        spawn_image(job);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].failed) {
+            printf("Error processing %s\n", inputs[i]);
+            failed++;
+        }
+    }
+    free(jobs);
+    return failed;
+}
@@ -0,0 +1,13 @@
+#ifndef ___OMP_TASKS
+#define ___OMP_TASKS
+
+#define OMP_TASK_BAND 32    // rows per filter, encode and taskloop grain
+
+void apply_filter_omp_tasks(unsigned char *input, unsigned char *output, int width, int height,
+                            int channels, float *kernel, int kernel_size);
+unsigned char *omp_tasks_filter_encode(unsigned char *input, int width, int height, int channels,
+                                       float **kernels, int num_passes, int kernel_size, int *png_len);
+int omp_tasks_pipeline(char **inputs, char **outputs, int count, float **kernels, int num_passes,
+                       int kernel_size);
+
+#endif
@@ -4,99 +4,67 @@
 #include <string.h>
 #include <math.h>
 #include <omp.h>
+#include "convolve.h"
+#include "omp_convolve.h"
+#include "omp_tasks.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-// Filter kernels
-float edge_kernel[9] = {-1, -1, -1, -1, 8, -1, -1, -1, -1};
-float sharpen_kernel[9] = {0, -1, 0, -1, 5, -1, 0, -1, 0};
-float blur_kernel[9] = {1.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9};
-float gaussian_kernel[9] = {1.0/16, 2.0/16, 1.0/16, 2.0/16, 4.0/16, 2.0/16, 1.0/16, 2.0/16, 1.0/16};
-float emboss_kernel[9] = {-2, -1, 0, -1, 1, 1, 0, 1, 2};
-float identity_kernel[9] = {0, 0, 0, 0, 1, 0, 0, 0, 0};
+#define MAX_LIST 32
 
-void apply_filter(unsigned char *input, unsigned char *output, int width, int height, 
-                  int channels, float *kernel, int kernel_size) {
-    int kernel_half = kernel_size / 2;
-    
-    #pragma omp parallel for collapse(2) schedule(dynamic)
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            for (int c = 0; c < channels; c++) {
-                float sum = 0.0;
-                
-                // Apply kernel
-                for (int ky = -kernel_half; ky <= kernel_half; ky++) {
-                    for (int kx = -kernel_half; kx <= kernel_half; kx++) {
-                        int img_y = y + ky;
-                        int img_x = x + kx;
-                        
-                        // Handle borders by clamping
-                        if (img_y < 0) img_y = 0;
-                        if (img_y >= height) img_y = height - 1;
-                        if (img_x < 0) img_x = 0;
-                        if (img_x >= width) img_x = width - 1;
-                        
-                        int pixel_idx = (img_y * width + img_x) * channels + c;
-                        int kernel_idx = (ky + kernel_half) * kernel_size + (kx + kernel_half);
-                        
-                        sum += input[pixel_idx] * kernel[kernel_idx];
-                    }
-                }
-                
-                // Clamp result to [0, 255]
-                int output_idx = (y * width + x) * channels + c;
-                output[output_idx] = (unsigned char)(fmax(0, fmin(255, sum)));
-            }
-        }
+// Splits a comma separated list in place
+int split_list(char *list, char **items) {
+    int n = 0;
+    for (char *item = strtok(list, ","); item != NULL && n < MAX_LIST; item = strtok(NULL, ",")) {
+        items[n++] = item;
     }
+    return n;
+}
+
+// <stem>_out.png in the current directory
+void output_name(const char *input, char *name, size_t size) {
+    const char *base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    const char *dot = strrchr(base, '.');
+    int stem = dot ? (int)(dot - base) : (int)strlen(base);
+    snprintf(name, size, "%.*s_out.png", stem, base);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s <input_image> <filter_type>\n", argv[0]);
+    if (argc < 3 || argc > 4 || (argc == 4 && strcmp(argv[3], "--tasks") != 0)) {
+        printf("Usage: %s <input_image>[,<input_image>...] <filter_type>[,<filter_type>...] [--tasks]\n", argv[0]);
         printf("Filter types: edge, sharpen, blur, gaussian, emboss, identity\n");
+        printf("A comma separated list of filters runs them in order.  With one input the result is saved to\n");
+        printf("output.png, with several to <stem>_out.png.\n");
+        printf("--tasks runs decoding, every filter pass and encoding as one task graph over row bands,\n");
+        printf("instead of a parallel for per pass\n");
         return 1;
     }
     
-    char *input_file = argv[1];
-    char *filter_type = argv[2];
-    
-    int width, height, channels;
-    unsigned char *img = stbi_load(input_file, &width, &height, &channels, 0);
-    
-    if (img == NULL) {
-        printf("Error loading image %s\n", input_file);
-        return 1;
-    }
-    
-    printf("Loaded image: %dx%d with %d channels\n", width, height, channels);
-    
-    unsigned char *output = (unsigned char *)malloc(width * height * channels);
-    
-    float *kernel = NULL;
+    char *inputs[MAX_LIST], *filters[MAX_LIST], *outputs[MAX_LIST];
+    char names[MAX_LIST][256];
+    char filter_type[1024];
+    snprintf(filter_type, sizeof(filter_type), "%s", argv[2]);
+    int num_inputs = split_list(argv[1], inputs);
+    int num_passes = split_list(argv[2], filters);
+    int tasks = argc == 4;
+    float *kernels[MAX_LIST];
     int kernel_size = 3;
     
-    if (strcmp(filter_type, "edge") == 0) {
-        kernel = edge_kernel;
-    } else if (strcmp(filter_type, "sharpen") == 0) {
-        kernel = sharpen_kernel;
-    } else if (strcmp(filter_type, "blur") == 0) {
-        kernel = blur_kernel;
-    } else if (strcmp(filter_type, "gaussian") == 0) {
-        kernel = gaussian_kernel;
-    } else if (strcmp(filter_type, "emboss") == 0) {
-        kernel = emboss_kernel;
-    } else if (strcmp(filter_type, "identity") == 0) {
-        kernel = identity_kernel;
-    } else {
-        printf("Unknown filter type: %s\n", filter_type);
-        stbi_image_free(img);
-        free(output);
-        return 1;
+    for (int p = 0; p < num_passes; p++) {
+        kernels[p] = lookup_kernel(filters[p]);
+        if (!kernels[p]) {
+            printf("Unknown filter type: %s\n", filters[p]);
+            return 1;
+        }
+    }
+    for (int i = 0; i < num_inputs; i++) {
+        if (num_inputs == 1) snprintf(names[i], sizeof(names[i]), "output.png");
+        else output_name(inputs[i], names[i], sizeof(names[i]));
+        outputs[i] = names[i];
     }
     
     int num_threads;
@@ -106,14 +74,50 @@ int main(int argc, char *argv[]) {
         num_threads = omp_get_num_threads();
     }
     
-    printf("Applying %s filter using OpenMP with %d threads...\n", filter_type, num_threads);
-    apply_filter(img, output, width, height, channels, kernel, kernel_size);
+    printf("Applying %s filter to %d image%s using OpenMP %s with %d threads...\n", filter_type, num_inputs,
+           num_inputs == 1 ? "" : "s", tasks ? "tasks" : "parallel for", num_threads);
+    double start = omp_get_wtime();
+    int failed = 0;
     
-    stbi_write_png("output.png", width, height, channels, output, width * channels);
-    printf("Output saved to output.png\n");
+    if (tasks) {
+        // Decoding happens inside the task graph, which plans from the headers
+        for (int i = 0; i < num_inputs; i++) {
+            int width, height, channels;
+            if (stbi_info(inputs[i], &width, &height, &channels)) {
+                printf("Loaded image: %dx%d with %d channels\n", width, height, channels);
+            }
+        }
+        failed = omp_tasks_pipeline(inputs, outputs, num_inputs, kernels, num_passes, kernel_size);
+    } else {
+        for (int i = 0; i < num_inputs; i++) {
+            int width, height, channels;
+            unsigned char *img = stbi_load(inputs[i], &width, &height, &channels, 0);
+            if (img == NULL) {
+                printf("Error loading image %s\n", inputs[i]);
+                failed++;
+                continue;
+            }
+            printf("Loaded image: %dx%d with %d channels\n", width, height, channels);
+            unsigned char *output = (unsigned char *)malloc((size_t)width * height * channels);
+            unsigned char *src = img, *dst = output;
+            for (int p = 0; p < num_passes; p++) {
+                apply_filter_omp(src, dst, width, height, channels, kernels[p], kernel_size);
+                unsigned char *tmp = src;
+                src = dst;
+                dst = tmp;
+            }
+            if (!stbi_write_png(outputs[i], width, height, channels, src, width * channels)) {
+                printf("Error writing %s\n", outputs[i]);
+                failed++;
+            }
+            stbi_image_free(img);
+            free(output);
+        }
+    }
     
-    stbi_image_free(img);
-    free(output);
+    printf("Finished in %.3f s\n", omp_get_wtime() - start);
+    if (num_inputs > 1) printf("Outputs saved as <stem>_out.png (%d failed)\n", failed);
+    else if (!failed) printf("Output saved to output.png\n");
     
-    return 0;
-}
\ No newline at end of file
+    return failed ? 1 : 0;
+}
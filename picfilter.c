@@ -0,0 +1,203 @@
+// picfilter.c - Python bindings for the convolution engine, working in place on NumPy arrays
+//
+//   import numpy as np, picfilter
+//   out = np.asarray(picfilter.convolve(image, "edge"))           # image is (height, width[, channels]) uint8
+//   picfilter.convolve(image, np.ones((5, 5), np.float32) / 25, out=out)
+//
+// Arrays are reached through the buffer protocol, so nothing is copied on the way in or out and
+// NumPy isn't needed at build time.  The GIL is released while the filter runs.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdlib.h>
+#include <string.h>
+#include "convolve.h"
+#include "linear.h"
+#include "lowrank.h"
+
+#define PICFILTER_MAX_BANDS 64
+
+// Accepts buffers of bytes: NumPy reports uint8 as "B", possibly with a byte order prefix
+static int format_is(Py_buffer *view, char code) {
+    const char *format = view->format ? view->format : "B";
+    if (*format && strchr("@=<>!", *format)) format++;
+    return format[0] == code && format[1] == 0;
+}
+
+static int image_shape(Py_buffer *view, const char *what, int *width, int *height, int *channels) {
+    if (!format_is(view, 'B') || (view->ndim != 2 && view->ndim != 3)) {
+        PyErr_Format(PyExc_ValueError, "%s must be a uint8 array of shape (height, width[, channels])", what);
+        return -1;
+    }
+    *height = (int)view->shape[0];
+    *width = (int)view->shape[1];
+    *channels = view->ndim == 3 ? (int)view->shape[2] : 1;
+    if (*channels < 1 || *channels > PICFILTER_MAX_BANDS || *width < 1 || *height < 1) {
+        PyErr_Format(PyExc_ValueError, "%s must be non-empty with at most %d channels", what, PICFILTER_MAX_BANDS);
+        return -1;
+    }
+    return 0;
+}
+
+// A kernel is a filter name, a (k, k) float array for every channel, or a (channels, k, k) array
+// with one kernel per channel.  Returns its weights as floats, or NULL with an exception set.
+static float *parse_kernel(PyObject *obj, int channels, int *kernel_size, int *per_band) {
+    *per_band = 0;
+    if (PyUnicode_Check(obj)) {
+        // Strings with lone surrogates can't be encoded; the exception is already set
+        const char *name = PyUnicode_AsUTF8(obj);
+        if (!name) return NULL;
+        float *named = lookup_kernel(name);
+        if (!named) {
+            PyErr_Format(PyExc_ValueError, "unknown kernel %R", obj);
+            return NULL;
+        }
+        float *weights = malloc(9 * sizeof(float));
+        memcpy(weights, named, 9 * sizeof(float));
+        *kernel_size = 3;
+        return weights;
+    }
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0) return NULL;
+    int ok = (format_is(&view, 'f') || format_is(&view, 'd')) && (view.ndim == 2 || view.ndim == 3);
+    int k = ok ? (int)view.shape[view.ndim - 1] : 0;
+    ok = ok && k % 2 == 1 && view.shape[view.ndim - 2] == k && (view.ndim == 2 || view.shape[0] == channels);
+    if (!ok) {
+        PyErr_SetString(PyExc_ValueError, "kernel must be a name or a float32/float64 array of shape "
+                        "(k, k) or (channels, k, k) with k odd");
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    Py_ssize_t count = view.len / view.itemsize;
+    float *weights = malloc(count * sizeof(float));
+    for (Py_ssize_t i = 0; i < count; i++) {
+        weights[i] = view.itemsize == 4 ? ((float *)view.buf)[i] : (float)((double *)view.buf)[i];
+    }
+    *kernel_size = k;
+    *per_band = view.ndim == 3;
+    PyBuffer_Release(&view);
+    return weights;
+}
+
+static PyObject *picfilter_convolve(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"image", "kernel", "out", "linear", "tolerance", NULL};
+    PyObject *image_obj, *kernel_obj, *out_obj = Py_None, *result = NULL;
+    int linear = 0;
+    double tolerance = LOWRANK_TOLERANCE;
+    lowrank_t lowrank = {0};
+    int width, height, channels, out_width, out_height, out_channels, kernel_size, per_band;
+    Py_buffer in, out;
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|Opd", keywords, &image_obj, &kernel_obj, &out_obj, &linear,
+                                     &tolerance)) {
+        return NULL;
+    }
+    if (PyObject_GetBuffer(image_obj, &in, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0) return NULL;
+    if (image_shape(&in, "image", &width, &height, &channels) < 0) {
+        PyBuffer_Release(&in);
+        return NULL;
+    }
+    if (linear && channels > 4) {
+        PyErr_SetString(PyExc_ValueError, "linear light filtering needs gray, RGB or RGBA images");
+        PyBuffer_Release(&in);
+        return NULL;
+    }
+    float *weights = parse_kernel(kernel_obj, channels, &kernel_size, &per_band);
+    if (!weights) {
+        PyBuffer_Release(&in);
+        return NULL;
+    }
+    if (linear && per_band) {
+        PyErr_SetString(PyExc_ValueError, "per channel kernels can't be used in linear light");
+        goto done;
+    }
+
+    // Without an out array the result goes into a new bytearray, returned as a memoryview of the
+    // image's shape that np.asarray wraps without copying
+    if (out_obj == Py_None) {
+        PyObject *storage = PyByteArray_FromStringAndSize(NULL, in.len);
+        if (!storage) goto done;
+        PyObject *view = PyMemoryView_FromObject(storage);
+        Py_DECREF(storage);
+        if (!view) goto done;
+        result = in.ndim == 3 ? PyObject_CallMethod(view, "cast", "s(nnn)", "B", in.shape[0], in.shape[1], in.shape[2])
+                              : PyObject_CallMethod(view, "cast", "s(nn)", "B", in.shape[0], in.shape[1]);
+        Py_DECREF(view);
+        if (!result) goto done;
+        out_obj = result;
+    } else {
+        Py_INCREF(out_obj);
+        result = out_obj;
+    }
+    if (PyObject_GetBuffer(out_obj, &out, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | PyBUF_WRITABLE) < 0) {
+        Py_CLEAR(result);
+        goto done;
+    }
+    if (image_shape(&out, "out", &out_width, &out_height, &out_channels) < 0 || out_width != width ||
+        out_height != height || out_channels != channels) {
+        if (!PyErr_Occurred()) PyErr_SetString(PyExc_ValueError, "out must have the same shape as image");
+        PyBuffer_Release(&out);
+        Py_CLEAR(result);
+        goto done;
+    }
+    // Every output pixel reads its neighbours' input, so the two can't share memory
+    if ((char *)out.buf < (char *)in.buf + in.len && (char *)in.buf < (char *)out.buf + out.len) {
+        PyErr_SetString(PyExc_ValueError, "out must not overlap image");
+        PyBuffer_Release(&out);
+        Py_CLEAR(result);
+        goto done;
+    }
+
+    // Larger kernels run as a sum of separable passes when a few come within the tolerance
+    if (!per_band && !linear && channels < 8 && kernel_size > 3) {
+        lowrank_decompose(weights, kernel_size, tolerance, &lowrank);
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    if (per_band) {
+        float *kernels[PICFILTER_MAX_BANDS];
+        for (int c = 0; c < channels; c++) kernels[c] = weights + c * kernel_size * kernel_size;
+        apply_filter_bands(in.buf, out.buf, width, height, channels, kernels, kernel_size);
+    } else if (linear) {
+        apply_filter_linear(in.buf, out.buf, width, height, channels, weights, kernel_size);
+    } else if (channels >= 8) {
+        float *kernels[PICFILTER_MAX_BANDS];
+        for (int c = 0; c < channels; c++) kernels[c] = weights;
+        apply_filter_bands(in.buf, out.buf, width, height, channels, kernels, kernel_size);
+    } else if (lowrank.vertical && lowrank_worthwhile(&lowrank)) {
+        apply_filter_lowrank(in.buf, out.buf, width, height, channels, &lowrank);
+    } else {
+        apply_filter(in.buf, out.buf, width, height, channels, weights, kernel_size);
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&out);
+
+done:
+    lowrank_free(&lowrank);
+    free(weights);
+    PyBuffer_Release(&in);
+    return result;
+}
+
+static PyMethodDef picfilter_methods[] = {
+    {"convolve", (PyCFunction)(void (*)(void))picfilter_convolve, METH_VARARGS | METH_KEYWORDS,
+     "convolve(image, kernel, out=None, linear=False, tolerance=0.01)\n\n"
+     "Convolves a uint8 array of shape (height, width[, channels]) with a named kernel (edge, sharpen,\n"
+     "blur, gaussian, emboss, identity), a (k, k) float array, or a (channels, k, k) array holding one\n"
+     "kernel per channel.  Borders are clamped.  The result is written into out if given, otherwise into\n"
+     "a new buffer; either way it is returned.  linear filters gray/RGB/RGBA images in linear light.\n"
+     "A kernel larger than 3x3 runs as a sum of separable passes when that many terms of its singular\n"
+     "value decomposition come within tolerance (relative Frobenius error) and need fewer taps."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef picfilter_module = {
+    PyModuleDef_HEAD_INIT, "picfilter", "Multithreaded image convolution on NumPy arrays.", -1, picfilter_methods,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_picfilter(void) {
+    return PyModule_Create(&picfilter_module);
+}
@@ -0,0 +1,147 @@
+// plan.c - Pre-flight memory and work estimates, read from image headers before anything is decoded
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "plan.h"
+#include "precision.h"
+#include "stb_image.h"
+
+static const char *mode_names[PLAN_MODES] = {"full", "out-of-core", "reject"};
+
+// Reads a single number from a file, or -1 if it's missing or says "max"
+static long long read_limit(const char *path) {
+    char buf[64];
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    long long value = fgets(buf, sizeof(buf), f) && buf[0] >= '0' && buf[0] <= '9' ? atoll(buf) : -1;
+    fclose(f);
+    return value;
+}
+
+static long long mem_available(void) {
+    char line[256];
+    long long kb = -1;
+    FILE *f = fopen("/proc/meminfo", "r");
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb < 0 ? -1 : kb * 1024;
+}
+
+//plan_memory_budget: 80% of what this process can still use: the smaller of the cgroup's headroom,
+//                    which is what gets a container OOM killed, and the system's available memory
+size_t plan_memory_budget(void) {
+    long long available = mem_available();
+    long long limit = read_limit("/sys/fs/cgroup/memory.max");
+    if (limit < 0) limit = read_limit("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+    long long used = read_limit("/sys/fs/cgroup/memory.current");
+    if (used < 0) used = read_limit("/sys/fs/cgroup/memory/memory.usage_in_bytes");
+    if (limit > 0 && used >= 0 && (available < 0 || limit - used < available)) available = limit - used;
+    if (available <= 0) available = 1LL << 30;
+    return (size_t)(available * 0.8);
+}
+
+// Uncompressed bytes each of an out-of-core job's tile caches may keep hot
+size_t plan_tile_budget(int width, int height, int channels) {
+    size_t quarter = (size_t)width * height * channels / 4;
+    return quarter < (64u << 20) ? quarter : (64u << 20);
+}
+
+// Working memory a filter allocates beyond its input and output frames.  Canny, adaptive and iir are
+// calibrated against VmHWM while filtering a 12 MP RGB image, so they include each thread's rows.
+static double stage_scratch(const char *name, int linear, size_t pixels, size_t samples) {
+    if (strcmp(name, "canny") == 0) return 13.5 * pixels;          // smoothed floats, classes, union-find
+    if (strcmp(name, "clahe") == 0) return pixels;                 // luma plane
+    if (strcmp(name, "iir") == 0) return 4.25 * samples;           // float plane between the passes
+    if (strcmp(name, "box") == 0) return 4.0 * samples;            // 32 bit sums
+    if (strcmp(name, "variance") == 0) return 12.0 * samples;      // sums and 64 bit squared sums
+    if (strcmp(name, "adaptive") == 0) return 5.5 * pixels;        // luma and its 32 bit sums
+    if (linear) return 2.0 * samples;                              // 15 bit linear copy
+    return 0;                                                      // row rings only
+}
+
+// Operations per sample, close enough to rank jobs and spot outliers
+static double stage_work(const char *name, float sigma) {
+    double taps = 2 * ceil(3 * sigma) + 1;
+    if (strcmp(name, "unsharp") == 0 || strcmp(name, "highpass") == 0) return 2 * taps + 4;
+    if (strcmp(name, "canny") == 0) return 2 * taps + 30;
+    if (strcmp(name, "iir") == 0) return 32;                       // four recursions, whatever sigma
+    if (strcmp(name, "clahe") == 0) return 12;
+    if (strcmp(name, "box") == 0 || strcmp(name, "variance") == 0 || strcmp(name, "adaptive") == 0) return 10;
+    return 9;
+}
+
+//plan_job: Estimates one job from its header.  In full-frame mode the peak is the largest of decoding
+//          (stb's buffers plus the image, and a 16 bit copy for 16 bit PNGs), filtering (input, output
+//          and the hungriest stage's scratch, plus lane packing for a lone kernel) and encoding (input
+//          and output, which stay allocated, plus about two frames of PNG filter rows and deflate
+//          output).  Out of core the input is dropped once it is tiled, filtering holds only the
+//          compressed tiles and each cache's hot budget, and the PNG is streamed from the last cache
+//          with a fixed few hundred KB of encoder state.
+void plan_job(const char *path, plan_chain_t *chain, size_t budget, job_plan_t *plan) {
+    memset(plan, 0, sizeof(job_plan_t));
+    if (!stbi_info(path, &plan->width, &plan->height, &plan->channels)) {
+        plan->width = plan->height = plan->channels = 0;
+        plan->mode = PLAN_FULL;    // left for the decoder to report
+        return;
+    }
+    plan->is_16_bit = stbi_is_16_bit(path);
+
+    size_t pixels = (size_t)plan->width * plan->height;
+    size_t samples = pixels * plan->channels;
+    double frame = (double)samples;
+    double decode = frame * (plan->is_16_bit ? 4 : 2);
+    double scratch = 0;
+    for (int i = 0; i < chain->num_stages; i++) {
+        double s = stage_scratch(chain->stages[i], chain->linear, pixels, samples);
+        if (s > scratch) scratch = s;
+        plan->work += samples * stage_work(chain->stages[i], chain->sigma) * chain->iterations;
+    }
+    if (chain->num_stages == 1 && chain->dense && !chain->linear) scratch += 2 * frame;
+    // Two intermediate planes between passes
+    if (chain->precision != PRECISION_U8 && chain->num_stages * chain->iterations > 1) {
+        scratch = fmax(scratch, 2.0 * samples * precision_bytes(chain->precision));
+    }
+    double encode = 2 * frame;
+    double hot = 2.0 * plan_tile_budget(plan->width, plan->height, plan->channels);
+
+    double full = fmax(decode, fmax(2 * frame + scratch, 2 * frame + encode));
+    double tiled = fmax(decode, 2 * frame + hot);
+
+    if (full <= budget || !chain->dense) {
+        plan->mode = full <= budget ? PLAN_FULL : PLAN_REJECT;
+        plan->peak_bytes = (size_t)full;
+    } else {
+        plan->mode = tiled <= budget ? PLAN_OUT_OF_CORE : PLAN_REJECT;
+        plan->peak_bytes = (size_t)tiled;
+    }
+}
+
+void plan_jobs(char **inputs, int count, plan_chain_t *chain, size_t budget, job_plan_t *plans) {
+    for (int i = 0; i < count; i++) plan_job(inputs[i], chain, budget, &plans[i]);
+}
+
+//plan_print: Summarizes a plan, and with verbose set lists every job
+void plan_print(char **inputs, int count, job_plan_t *plans, size_t budget, int verbose) {
+    int modes[PLAN_MODES] = {0};
+    size_t largest = 0;
+    double work = 0;
+
+    for (int i = 0; i < count; i++) {
+        job_plan_t *plan = &plans[i];
+        modes[plan->mode]++;
+        work += plan->work;
+        if (plan->peak_bytes > largest) largest = plan->peak_bytes;
+        if (verbose) {
+            printf("  %-40s %6dx%-6d x%d%s %-12s peak %9.1f MB  work %8.2f Gop\n", inputs[i], plan->width,
+                   plan->height, plan->channels, plan->is_16_bit ? " 16 bit" : "       ", mode_names[plan->mode],
+                   plan->peak_bytes / 1048576.0, plan->work / 1e9);
+        }
+    }
+    printf("Plan: %d full-frame, %d out-of-core, %d rejected; largest job %.1f MB of a %.1f MB budget, "
+           "%.2f Gop total\n", modes[PLAN_FULL], modes[PLAN_OUT_OF_CORE], modes[PLAN_REJECT],
+           largest / 1048576.0, budget / 1048576.0, work / 1e9);
+}
@@ -0,0 +1,35 @@
+#ifndef ___PLAN
+#define ___PLAN
+#include <stddef.h>
+
+// How a job will be run.  Full-frame jobs share micro-batches; out-of-core jobs hold their
+// intermediates in compressed tile caches and run alone; rejected jobs would not fit at all.
+enum PlanModes{PLAN_FULL=0,PLAN_OUT_OF_CORE=1,PLAN_REJECT=2,PLAN_MODES=3};
+
+typedef struct {
+    char **stages;
+    int num_stages;
+    int linear;
+    float sigma;
+    int dense;                 // every stage is a dense kernel, so the job can run out of core
+    int iterations;            // times the chain runs
+    int precision;             // PrecisionFormats value of a dense chain's intermediates
+} plan_chain_t;
+
+typedef struct {
+    int width;                 // 0 if the header couldn't be read
+    int height;
+    int channels;
+    int is_16_bit;
+    int mode;
+    size_t peak_bytes;         // estimated high water mark in the chosen mode
+    double work;               // estimated sample operations for the whole chain
+} job_plan_t;
+
+size_t plan_memory_budget(void);
+size_t plan_tile_budget(int width, int height, int channels);
+void plan_job(const char *path, plan_chain_t *chain, size_t budget, job_plan_t *plan);
+void plan_jobs(char **inputs, int count, plan_chain_t *chain, size_t budget, job_plan_t *plans);
+void plan_print(char **inputs, int count, job_plan_t *plans, size_t budget, int verbose);
+
+#endif
@@ -0,0 +1,309 @@
+// png_stream.c - PNG encoder that takes the image a few rows at a time
+//
+// stbi_write_png filters and deflates the whole image in memory before writing anything.  Here each
+// pushed row is PNG filtered as it arrives, choosing the filter the way stb does, and fed to a
+// deflate that keeps only a 32 KB history and, like stb's, emits one block of fixed Huffman codes.
+// Compressed bytes leave in IDAT chunks through the write callback.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "png_stream.h"
+
+// A private copy of the writer, for its PNG line filter and CRC
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#define HASH_BITS 15
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_CHAIN 16        // candidates tried per position, about what stb's default level tries
+
+// Base values and extra bits of the deflate length and distance codes, each with a sentinel
+static const unsigned short length_base[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43,
+                                             51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 259};
+static const unsigned char length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                             4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short dist_base[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                           513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+                                           24577, 32769};
+static const unsigned char dist_extra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
+                                           9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static void put_be32(unsigned char *p, unsigned int v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+// Wraps length bytes of payload, which follow the 8 bytes left for length and tag, into a chunk
+static void write_chunk(png_stream_t *stream, unsigned char *chunk, const char *tag, int length) {
+    put_be32(chunk, length);
+    memcpy(chunk + 4, tag, 4);
+    put_be32(chunk + 8 + length, stbiw__crc32(chunk + 4, length + 4));
+    stream->write(stream->ctx, chunk, length + 12);
+}
+
+static void put_byte(png_stream_t *stream, unsigned char b) {
+    stream->chunk[8 + stream->chunk_len++] = b;
+    if (stream->chunk_len == PNG_STREAM_CHUNK) {
+        write_chunk(stream, stream->chunk, "IDAT", stream->chunk_len);
+        stream->chunk_len = 0;
+    }
+}
+
+// Deflate packs bits from the least significant end of each byte
+static void put_bits(png_stream_t *stream, unsigned int code, int count) {
+    stream->bits |= code << stream->bit_count;
+    stream->bit_count += count;
+    while (stream->bit_count >= 8) {
+        put_byte(stream, (unsigned char)stream->bits);
+        stream->bits >>= 8;
+        stream->bit_count -= 8;
+    }
+}
+
+// Huffman codes are stored most significant bit first
+static unsigned int reverse_bits(unsigned int code, int count) {
+    unsigned int reversed = 0;
+    while (count--) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+// A literal/length symbol in the fixed Huffman code
+static void put_symbol(png_stream_t *stream, int symbol) {
+    if (symbol <= 143) put_bits(stream, reverse_bits(0x30 + symbol, 8), 8);
+    else if (symbol <= 255) put_bits(stream, reverse_bits(0x190 + symbol - 144, 9), 9);
+    else if (symbol <= 279) put_bits(stream, reverse_bits(symbol - 256, 7), 7);
+    else put_bits(stream, reverse_bits(0xc0 + symbol - 280, 8), 8);
+}
+
+static void put_match(png_stream_t *stream, int length, int distance) {
+    int j = 0;
+    while (length >= length_base[j + 1]) j++;
+    put_symbol(stream, 257 + j);
+    if (length_extra[j]) put_bits(stream, length - length_base[j], length_extra[j]);
+    j = 0;
+    while (distance >= dist_base[j + 1]) j++;
+    put_bits(stream, reverse_bits(j, 5), 5);
+    if (dist_extra[j]) put_bits(stream, distance - dist_base[j], dist_extra[j]);
+}
+
+static int hash3(const unsigned char *p) {
+    return (int)((unsigned int)(p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u >> (32 - HASH_BITS));
+}
+
+static void insert(png_stream_t *stream, int p) {
+    if (p + MIN_MATCH > stream->window_len) return;
+    int h = hash3(stream->window + p);
+    stream->chain[p & (PNG_STREAM_WINDOW - 1)] = stream->head[h];
+    stream->head[h] = p;
+}
+
+// Length of the longest earlier match for the bytes at p, or 0 if there is none worth coding
+static int longest_match(png_stream_t *stream, int p, int *distance) {
+    if (p + MIN_MATCH > stream->window_len) return 0;
+    const unsigned char *current = stream->window + p;
+    int limit = stream->window_len - p < MAX_MATCH ? stream->window_len - p : MAX_MATCH;
+    int best = 0;
+    int candidate = stream->head[hash3(current)];
+
+    for (int tries = 0; candidate >= 0 && p - candidate < PNG_STREAM_WINDOW && tries < MAX_CHAIN; tries++) {
+        const unsigned char *match = stream->window + candidate;
+        if (match[best] == current[best]) {
+            int n = 0;
+            while (n < limit && match[n] == current[n]) n++;
+            if (n > best) {
+                best = n;
+                *distance = p - candidate;
+                if (n == limit) break;
+            }
+        }
+        // Chain slots are reused a window later, so a link that doesn't lead further back is stale
+        int next = stream->chain[candidate & (PNG_STREAM_WINDOW - 1)];
+        if (next >= candidate) break;
+        candidate = next;
+    }
+    return best >= MIN_MATCH ? best : 0;
+}
+
+// Encodes the window up to the last MAX_MATCH bytes, which later input may still extend a match
+// into, or to its end once there is no more input.  A match is put off by a byte when the next
+// position has a longer one, as stb does.
+static void deflate_window(png_stream_t *stream, int final) {
+    int end = final ? stream->window_len : stream->window_len - MAX_MATCH;
+    while (stream->pos < end) {
+        int p = stream->pos, distance, next_distance;
+        int length = longest_match(stream, p, &distance);
+        insert(stream, p);
+        if (length && p + 1 < end && longest_match(stream, p + 1, &next_distance) > length) length = 0;
+        if (!length) {
+            put_symbol(stream, stream->window[p]);
+            stream->pos++;
+            continue;
+        }
+        put_match(stream, length, distance);
+        for (int i = 1; i < length; i++) insert(stream, p + i);
+        stream->pos += length;
+    }
+}
+
+// Drops the older of the two windows, moving positions down with the bytes
+static void slide_window(png_stream_t *stream) {
+    memmove(stream->window, stream->window + PNG_STREAM_WINDOW, stream->window_len - PNG_STREAM_WINDOW);
+    stream->window_len -= PNG_STREAM_WINDOW;
+    stream->pos -= PNG_STREAM_WINDOW;
+    for (int i = 0; i < (1 << HASH_BITS); i++) {
+        stream->head[i] = stream->head[i] >= PNG_STREAM_WINDOW ? stream->head[i] - PNG_STREAM_WINDOW : -1;
+    }
+    for (int i = 0; i < PNG_STREAM_WINDOW; i++) {
+        stream->chain[i] = stream->chain[i] >= PNG_STREAM_WINDOW ? stream->chain[i] - PNG_STREAM_WINDOW : -1;
+    }
+}
+
+static void deflate_bytes(png_stream_t *stream, const unsigned char *data, int length) {
+    // Adler-32 with the modulo taken once per 5552 bytes, the most that can't overflow
+    for (int i = 0; i < length; i += 5552) {
+        int n = length - i < 5552 ? length - i : 5552;
+        for (int j = i; j < i + n; j++) {
+            stream->adler_a += data[j];
+            stream->adler_b += stream->adler_a;
+        }
+        stream->adler_a %= 65521;
+        stream->adler_b %= 65521;
+    }
+
+    while (length > 0) {
+        int n = 2 * PNG_STREAM_WINDOW - stream->window_len;
+        if (n > length) n = length;
+        memcpy(stream->window + stream->window_len, data, n);
+        stream->window_len += n;
+        data += n;
+        length -= n;
+        if (stream->window_len == 2 * PNG_STREAM_WINDOW) {
+            deflate_window(stream, 0);
+            slide_window(stream);
+        }
+    }
+}
+
+// Filters one row and deflates it.  pixels holds the row at y of a two row image with the given
+// pitch, so y is 1 and the row above sits at pixels, or 0 for the top row of the image.
+static void encode_row(png_stream_t *stream, unsigned char *pixels, int pitch, int y) {
+    int best_filter = 0, best_value = 0x7fffffff;
+    int stride = (int)stream->stride;
+    for (int filter_type = 0; filter_type < 5; filter_type++) {
+        stbiw__encode_png_line(pixels, pitch, stream->width, 2, y, stream->channels, filter_type, stream->line);
+        int estimate = 0;
+        for (int i = 0; i < stride; i++) estimate += abs(stream->line[i]);
+        if (estimate < best_value) {
+            best_value = estimate;
+            best_filter = filter_type;
+        }
+    }
+    if (best_filter != 4) {
+        stbiw__encode_png_line(pixels, pitch, stream->width, 2, y, stream->channels, best_filter, stream->line);
+    }
+    unsigned char type = (unsigned char)best_filter;
+    deflate_bytes(stream, &type, 1);
+    deflate_bytes(stream, (unsigned char *)stream->line, stride);
+}
+
+//png_stream_begin: Starts a PNG of 8 bit pixels with 1 to 4 channels, writing its header at once
+//Returns: The encoder, or NULL if the size or channel count can't be encoded
+png_stream_t *png_stream_begin(int width, int height, int channels, png_write_t write, void *ctx) {
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    static const unsigned char color_types[5] = {0, 0, 4, 2, 6};
+    if (width <= 0 || height <= 0 || channels < 1 || channels > 4 || (size_t)width * channels > 0x7fffffff) {
+        return NULL;
+    }
+
+    png_stream_t *stream = calloc(1, sizeof(png_stream_t));
+    stream->write = write;
+    stream->ctx = ctx;
+    stream->width = width;
+    stream->height = height;
+    stream->channels = channels;
+    stream->stride = (size_t)width * channels;
+    stream->pair = malloc(2 * stream->stride);
+    stream->line = malloc(stream->stride);
+    stream->window = malloc(2 * PNG_STREAM_WINDOW);
+    stream->head = malloc((1 << HASH_BITS) * sizeof(int));
+    stream->chain = malloc(PNG_STREAM_WINDOW * sizeof(int));
+    stream->chunk = malloc(PNG_STREAM_CHUNK + 12);
+    memset(stream->head, 0xff, (1 << HASH_BITS) * sizeof(int));
+    memset(stream->chain, 0xff, PNG_STREAM_WINDOW * sizeof(int));
+    stream->adler_a = 1;
+
+    unsigned char header[8 + 12 + 13];
+    memcpy(header, signature, 8);
+    put_be32(header + 16, width);
+    put_be32(header + 20, height);
+    header[24] = 8;
+    header[25] = color_types[channels];
+    header[26] = header[27] = header[28] = 0;
+    write(ctx, header, 8);
+    write_chunk(stream, header + 8, "IHDR", 13);
+
+    // zlib header, as stb writes it, then a single final block of fixed Huffman codes
+    put_byte(stream, 0x78);
+    put_byte(stream, 0x5e);
+    put_bits(stream, 1, 1);
+    put_bits(stream, 1, 2);
+    return stream;
+}
+
+//png_stream_push_rows: Encodes the next count rows, stride bytes apart.  Only the last of them is kept,
+//                      so the caller may reuse the memory as soon as this returns.
+//Returns: 1, or 0 if that would be more rows than the image has
+int png_stream_push_rows(png_stream_t *stream, const unsigned char *rows, int count, size_t stride) {
+    if (count <= 0) return 1;
+    if (count > stream->height - stream->rows) return 0;
+
+    for (int i = 0; i < count; i++) {
+        unsigned char *row = (unsigned char *)rows + i * stride;
+        if (stream->rows == 0) {
+            encode_row(stream, row, (int)stride, 0);
+        } else if (i > 0) {
+            encode_row(stream, row - stride, (int)stride, 1);
+        } else {
+            // The row above came with the previous push; pair it with this one
+            memcpy(stream->pair + stream->stride, row, stream->stride);
+            encode_row(stream, stream->pair, (int)stream->stride, 1);
+        }
+        stream->rows++;
+    }
+    memcpy(stream->pair, rows + (count - 1) * stride, stream->stride);
+    return 1;
+}
+
+//png_stream_end: Flushes the last compressed bytes, writes the trailer and frees the encoder
+//Returns: 1 if every row of the image was pushed, 0 if the file is short
+int png_stream_end(png_stream_t *stream) {
+    int complete = stream->rows == stream->height;
+    deflate_window(stream, 1);
+    put_symbol(stream, 256);
+    if (stream->bit_count) put_bits(stream, 0, 8 - stream->bit_count);
+    unsigned int adler = stream->adler_b << 16 | stream->adler_a;
+    for (int shift = 24; shift >= 0; shift -= 8) put_byte(stream, (unsigned char)(adler >> shift));
+    if (stream->chunk_len) write_chunk(stream, stream->chunk, "IDAT", stream->chunk_len);
+    write_chunk(stream, stream->chunk, "IEND", 0);
+
+    free(stream->pair);
+    free(stream->line);
+    free(stream->window);
+    free(stream->head);
+    free(stream->chain);
+    free(stream->chunk);
+    free(stream);
+    return complete;
+}
+
+// Write callback for a FILE *
+void png_write_file(void *ctx, const void *data, int size) {
+    fwrite(data, 1, size, (FILE *)ctx);
+}
@@ -0,0 +1,44 @@
+#ifndef ___PNG_STREAM
+#define ___PNG_STREAM
+#include <stddef.h>
+
+#define PNG_STREAM_WINDOW 32768     // deflate history, the most deflate allows
+#define PNG_STREAM_CHUNK 65536      // IDAT payload gathered before it is handed to the callback
+
+// Receives the next size bytes of the file
+typedef void (*png_write_t)(void *ctx, const void *data, int size);
+
+// An 8 bit PNG being encoded top to bottom.  Its memory is a few rows plus the deflate window and
+// one IDAT chunk, whatever the height of the image.
+typedef struct {
+    png_write_t write;
+    void *ctx;
+    int width;
+    int height;
+    int channels;
+    int rows;                 // pushed so far
+    size_t stride;
+    unsigned char *pair;      // the last row pushed, which the Up, Average and Paeth filters read, and
+                              // room after it for the first row of the next push
+    signed char *line;
+    // deflate
+    unsigned char *window;    // two windows' worth: history, then bytes waiting to be matched
+    int window_len;
+    int pos;                  // next byte of window to encode
+    int *head;                // newest position per hash, -1 if none
+    int *chain;               // previous position with the same hash, by position modulo the window
+    unsigned int bits;
+    int bit_count;
+    unsigned int adler_a;
+    unsigned int adler_b;
+    unsigned char *chunk;     // length and tag, then the payload being gathered, then room for the CRC
+    int chunk_len;
+} png_stream_t;
+
+png_stream_t *png_stream_begin(int width, int height, int channels, png_write_t write, void *ctx);
+int png_stream_push_rows(png_stream_t *stream, const unsigned char *rows, int count, size_t stride);
+int png_stream_end(png_stream_t *stream);
+
+void png_write_file(void *ctx, const void *data, int size);
+
+#endif
@@ -0,0 +1,300 @@
+// pool.c - Splits row ranges across pthreads for the filter engine
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "pool.h"
+
+#define POOL_MAX_CPUS 1024
+#define POOL_CAPACITY_TOLERANCE 10    // percent; capacities closer than this are one core type
+
+typedef struct {
+    int cpu;
+    int capacity;    // relative performance, from cpu_capacity or the max frequency
+    int cluster;
+    int core;        // lowest CPU number among its SMT siblings, identifying the physical core
+    int smt_rank;    // 0 for a core's first hardware thread, 1 for its sibling, ...
+} pool_cpu_t;
+
+typedef struct {
+    int capacity;
+    long rows;
+    double seconds;  // summed busy time of every thread of this type
+    int threads;
+} pool_type_stats_t;
+
+typedef struct {
+    row_task_t task;
+    void *arg;
+    int start_row;
+    int end_row;
+    int type;        // index into type_stats, -1 on homogeneous machines
+} pool_slice_t;
+
+static pool_cpu_t cpus[POOL_MAX_CPUS];
+static int num_cpus;
+static int heterogeneous;
+static int has_smt;
+static int smt_mode = POOL_SMT_AUTO;
+static int smt_explicit;      // set by pool_set_smt; until then SMT placement is left to the scheduler
+static int pinned;
+// CPUs the threads are pinned to and each thread's share of the rows, fastest first.  There are
+// never more core types in use than threads.
+static int thread_cpu[NUM_THREADS];
+static int thread_type[NUM_THREADS];
+static pool_type_stats_t type_stats[NUM_THREADS];
+static int num_types;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long read_sysfs(int cpu, const char *file, long fallback) {
+    char path[256];
+    long value;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+    FILE *f = fopen(path, "r");
+    if (!f) return fallback;
+    if (fscanf(f, "%ld", &value) != 1) value = fallback;
+    fclose(f);
+    return value;
+}
+
+// The first number of a sysfs CPU list such as "0,64" or "2-3", or fallback
+static int read_first_cpu(int cpu, const char *file, int fallback) {
+    char path[256];
+    int first;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+    FILE *f = fopen(path, "r");
+    if (!f) return fallback;
+    if (fscanf(f, "%d", &first) != 1) first = fallback;
+    fclose(f);
+    return first;
+}
+
+// Fastest cores first, keeping clusters together.  With compact set a core's siblings sit next to
+// each other; otherwise every core's first thread comes before any second thread.
+static int compare_cpus(const void *a, const void *b, void *compact) {
+    const pool_cpu_t *ca = (const pool_cpu_t *)a, *cb = (const pool_cpu_t *)b;
+    if (ca->capacity != cb->capacity) return cb->capacity - ca->capacity;
+    if (!*(int *)compact && ca->smt_rank != cb->smt_rank) return ca->smt_rank - cb->smt_rank;
+    if (ca->cluster != cb->cluster) return ca->cluster - cb->cluster;
+    if (ca->core != cb->core) return ca->core - cb->core;
+    return ca->cpu - cb->cpu;
+}
+
+// Hands CPUs to the threads in turn for the current SMT mode.  Threads are only pinned when the
+// placement matters: on hybrid machines, or when an SMT mode was asked for and there are siblings to
+// avoid or to pack onto.  Every process picks the same CPUs, so pinning by default would pile
+// concurrent runs onto the same cores where the scheduler would spread them.
+static void assign_threads(void) {
+    pool_cpu_t order[POOL_MAX_CPUS];
+    int count = 0, compact = smt_mode == POOL_SMT_ON;
+
+    for (int i = 0; i < num_cpus; i++) {
+        if (smt_mode == POOL_SMT_OFF && cpus[i].smt_rank > 0) continue;
+        order[count++] = cpus[i];
+    }
+    qsort_r(order, count, sizeof(pool_cpu_t), compare_cpus, &compact);
+
+    num_types = 0;
+    memset(type_stats, 0, sizeof(type_stats));
+    pinned = count > 0 && (heterogeneous || (smt_explicit && has_smt));
+    if (count == 0) return;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pool_cpu_t *cpu = &order[i % count];
+        int type = 0;
+        while (type < num_types && type_stats[type].capacity != cpu->capacity) type++;
+        if (type == num_types) type_stats[num_types++].capacity = cpu->capacity;
+        thread_cpu[i] = cpu->cpu;
+        thread_type[i] = type;
+        type_stats[type].threads++;
+    }
+}
+
+// Groups capacities from the fastest down: each group takes every CPU within POOL_CAPACITY_TOLERANCE
+// percent of its fastest member and reports that capacity, so the favored cores of Turbo Boost Max
+// 3.0 parts, a few percent faster than their neighbours, stay one core type with them.  P and E cores
+// are much further apart than that.
+static void merge_capacities(void) {
+    static char grouped[POOL_MAX_CPUS];
+    for (;;) {
+        int top = -1;
+        for (int i = 0; i < num_cpus; i++) {
+            if (!grouped[i] && (top < 0 || cpus[i].capacity > cpus[top].capacity)) top = i;
+        }
+        if (top < 0) return;
+        int leader = cpus[top].capacity;
+        for (int i = 0; i < num_cpus; i++) {
+            if (!grouped[i] && cpus[i].capacity * (100L + POOL_CAPACITY_TOLERANCE) >= leader * 100L) {
+                cpus[i].capacity = leader;
+                grouped[i] = 1;
+            }
+        }
+    }
+}
+
+// Reads each online CPU's capacity from sysfs.  ARM and recent x86 kernels publish cpu_capacity;
+// otherwise the maximum frequency is the best proxy for P-core vs E-core.  If every CPU reports
+// the same capacity, within POOL_CAPACITY_TOLERANCE, the machine is homogeneous and the pool keeps
+// its plain equal split.  thread_siblings_list groups the hardware threads of each physical core.
+static void detect_topology(void) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    for (int cpu = 0; cpu < POOL_MAX_CPUS && num_cpus < POOL_MAX_CPUS; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (read_sysfs(cpu, "online", 1) == 0) continue;
+        long capacity = read_sysfs(cpu, "cpu_capacity", -1);
+        if (capacity < 0) capacity = read_sysfs(cpu, "cpufreq/cpuinfo_max_freq", 1024000) / 1000;
+        cpus[num_cpus].cpu = cpu;
+        cpus[num_cpus].capacity = (int)capacity;
+        cpus[num_cpus].cluster = (int)read_sysfs(cpu, "topology/cluster_id", 0);
+        cpus[num_cpus].core = read_first_cpu(cpu, "topology/thread_siblings_list", cpu);
+        num_cpus++;
+    }
+    merge_capacities();
+    for (int i = 0; i < num_cpus; i++) {
+        if (cpus[i].capacity != cpus[0].capacity) heterogeneous = 1;
+        cpus[i].smt_rank = 0;
+        for (int j = 0; j < i; j++) {
+            if (cpus[j].core == cpus[i].core) cpus[i].smt_rank++;
+        }
+        if (cpus[i].smt_rank > 0) has_smt = 1;
+    }
+    assign_threads();
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *run_slice(void *arg) {
+    pool_slice_t *slice = (pool_slice_t *)arg;
+    if (slice->type < 0) {
+        slice->task(slice->arg, slice->start_row, slice->end_row);
+        return NULL;
+    }
+
+    double start = now_seconds();
+    slice->task(slice->arg, slice->start_row, slice->end_row);
+    double elapsed = now_seconds() - start;
+
+    pthread_mutex_lock(&stats_lock);
+    type_stats[slice->type].rows += slice->end_row - slice->start_row;
+    type_stats[slice->type].seconds += elapsed;
+    pthread_mutex_unlock(&stats_lock);
+    return NULL;
+}
+
+//parallel_rows: Runs task over [0, height) using NUM_THREADS threads and returns once every band is finished.
+//               On homogeneous machines each thread takes an equal band and the last picks up the remainder.
+//               On hybrid machines threads are pinned fastest core first and bands are sized by core capacity,
+//               so slow cores finish at the same time as fast ones.  With SMT, threads are pinned as the
+//               pool_set_smt mode places them once it has been called.
+void parallel_rows(int height, row_task_t task, void *arg) {
+    pthread_t threads[NUM_THREADS];
+    pool_slice_t slices[NUM_THREADS];
+
+    pthread_once(&topology_once, detect_topology);
+
+    int rows_per_thread = height / NUM_THREADS;
+    long total_capacity = 0;
+    for (int i = 0; heterogeneous && i < NUM_THREADS; i++) total_capacity += type_stats[thread_type[i]].capacity;
+
+    long capacity_before = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        slices[i].task = task;
+        slices[i].arg = arg;
+        if (!heterogeneous) {
+            slices[i].start_row = i * rows_per_thread;
+            slices[i].end_row = (i == NUM_THREADS - 1) ? height : (i + 1) * rows_per_thread;
+            slices[i].type = -1;
+            if (!pinned) {
+                pthread_create(&threads[i], NULL, run_slice, &slices[i]);
+                continue;
+            }
+        } else {
+            long capacity = type_stats[thread_type[i]].capacity;
+            slices[i].start_row = (int)(height * capacity_before / total_capacity);
+            slices[i].end_row = (i == NUM_THREADS - 1) ? height : (int)(height * (capacity_before + capacity) / total_capacity);
+            slices[i].type = thread_type[i];
+            capacity_before += capacity;
+        }
+
+        pthread_attr_t attr;
+        cpu_set_t set;
+        pthread_attr_init(&attr);
+        CPU_ZERO(&set);
+        CPU_SET(thread_cpu[i], &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        if (pthread_create(&threads[i], &attr, run_slice, &slices[i]) != 0) {
+            pthread_create(&threads[i], NULL, run_slice, &slices[i]);
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+//pool_heterogeneous: Returns nonzero if the CPUs the process may run on have different capacities
+int pool_heterogeneous(void) {
+    pthread_once(&topology_once, detect_topology);
+    return heterogeneous;
+}
+
+//pool_smt_available: Returns nonzero if some physical core offers the process more than one hardware thread
+int pool_smt_available(void) {
+    pthread_once(&topology_once, detect_topology);
+    return has_smt;
+}
+
+//pool_parse_smt: Maps "off", "on" or "auto" to its PoolSmtModes value
+//Returns: The mode, or -1 for any other name
+int pool_parse_smt(const char *name) {
+    if (strcmp(name, "off") == 0) return POOL_SMT_OFF;
+    if (strcmp(name, "on") == 0) return POOL_SMT_ON;
+    if (strcmp(name, "auto") == 0) return POOL_SMT_AUTO;
+    return -1;
+}
+
+//pool_set_smt: Pins the threads of later parallel_rows calls as mode places them.  Not to be called
+//              while parallel_rows is running.
+void pool_set_smt(int mode) {
+    pthread_once(&topology_once, detect_topology);
+    smt_mode = mode;
+    smt_explicit = 1;
+    assign_threads();
+}
+
+//pool_print_stats: Prints rows per second per thread for each core type seen by parallel_rows
+void pool_print_stats(void) {
+    pthread_once(&topology_once, detect_topology);
+    if (has_smt) {
+        static const char *modes[] = {"off", "on", "auto"};
+        if (pinned) {
+            printf("Pool: SMT %s, threads on CPUs", modes[smt_mode]);
+            for (int i = 0; i < NUM_THREADS; i++) printf(" %d", thread_cpu[i]);
+            printf("\n");
+        } else {
+            printf("Pool: SMT siblings available, threads placed by the scheduler\n");
+        }
+    }
+    if (!heterogeneous) {
+        printf("Pool: %d CPUs of one core type, equal row split\n", num_cpus);
+        return;
+    }
+    printf("Pool: %d core types, rows split by capacity\n", num_types);
+    for (int t = 0; t < num_types; t++) {
+        pool_type_stats_t *s = &type_stats[t];
+        printf("  capacity %5d: %d threads, %ld rows, %.0f rows/s per thread\n", s->capacity, s->threads,
+               s->rows, s->seconds > 0 ? s->rows / s->seconds : 0.0);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef ___POOL
+#define ___POOL
+
+#define NUM_THREADS 4
+
+// Where workers go on CPUs with SMT (hyper-threading), once pool_set_smt picks a mode; until then the
+// scheduler places them.  OFF gives each worker a physical core of its own and never uses sibling
+// hardware threads; ON fills both threads of a core before moving to the next; AUTO spreads over
+// physical cores first and only then doubles up on siblings.
+enum PoolSmtModes{POOL_SMT_OFF=0,POOL_SMT_ON=1,POOL_SMT_AUTO=2};
+
+// A task processes the half-open row range [start_row, end_row) of whatever arg describes.
+typedef void (*row_task_t)(void *arg, int start_row, int end_row);
+
+void parallel_rows(int height, row_task_t task, void *arg);
+int pool_heterogeneous(void);
+int pool_smt_available(void);
+int pool_parse_smt(const char *name);
+void pool_set_smt(int mode);
+void pool_print_stats(void);
+
+#endif
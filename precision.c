@@ -0,0 +1,237 @@
+// precision.c - Chains of dense kernels carrying wider intermediates than 8 bits
+//
+// Chaining apply_filter rounds every intermediate down to a clamped byte, so a blur followed by a
+// sharpen sharpens the blur's truncation error and an edge pass loses everything below zero.  Float
+// intermediates keep it all but move four times the bytes between passes.  Here each pass reads and
+// writes its intermediate in the chosen format, computes in float, and only the last pass stores
+// bytes.
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "precision.h"
+#include "pool.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRECISION_X86 1
+#endif
+
+static const char *format_names[PRECISION_FORMATS] = {"u8", "i16", "f16", "f32"};
+static const size_t format_bytes[PRECISION_FORMATS] = {1, 2, 2, 4};
+
+typedef struct {
+    const void *input;
+    int input_format;
+    void *output;
+    int output_format;
+    int width;
+    int height;
+    int channels;
+    const float *table;   // kernel_size^2 taps of channels weights, as built by build_band_kernel
+    int kernel_size;
+    int uniform;          // every band has the same weights
+} precision_job_t;
+
+//precision_parse: Maps "u8", "i16", "f16" or "f32" to its PrecisionFormats value
+//Returns: The format, or -1 for any other name
+int precision_parse(const char *name) {
+    for (int f = 0; f < PRECISION_FORMATS; f++) {
+        if (strcmp(name, format_names[f]) == 0) return f;
+    }
+    return -1;
+}
+
+const char *precision_name(int format) {
+    return format_names[format];
+}
+
+// Bytes per sample of an intermediate
+size_t precision_bytes(int format) {
+    return format_bytes[format];
+}
+
+// Half precision by hand, rounding to nearest even, for CPUs without F16C
+static uint16_t float_to_half(float value) {
+    uint32_t x;
+    memcpy(&x, &value, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000, abs = x & 0x7fffffff;
+    if (abs > 0x7f800000) return sign | 0x7e00;                 // NaN
+    if (abs >= 0x477ff000) return sign | 0x7c00;                // 65520 and up round to infinity
+    if (abs < 0x33000000) return sign;                          // 2^-25 and below round to zero
+    if (abs < 0x38800000) {
+        // Subnormal: the significand in units of 2^-24
+        uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+        int shift = 126 - (int)(abs >> 23);
+        uint32_t q = mantissa >> shift, rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (q & 1))) q++;
+        return sign | q;
+    }
+    uint32_t h = (abs >> 13) - (112 << 10), rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+    return sign | h;
+}
+
+static float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16, exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+    if (exponent == 0) {
+        float value = mantissa * (1.0f / 16777216);
+        return sign ? -value : value;
+    }
+    uint32_t x = sign | (exponent == 31 ? 0x7f800000 : (exponent + 112) << 23) | (mantissa << 13);
+    float value;
+    memcpy(&value, &x, sizeof(value));
+    return value;
+}
+
+#ifdef PRECISION_X86
+__attribute__((target("avx,f16c"))) static void load_f16c(const uint16_t *src, float *dst, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    for (; i < n; i++) dst[i] = _cvtsh_ss(src[i]);
+}
+
+__attribute__((target("avx,f16c"))) static void store_f16c(const float *src, uint16_t *dst, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    for (; i < n; i++) dst[i] = _cvtss_sh(src[i], _MM_FROUND_TO_NEAREST_INT);
+}
+#endif
+
+//precision_f16_hardware: Returns nonzero if half precision is converted with F16C instructions
+int precision_f16_hardware(void) {
+#ifdef PRECISION_X86
+    return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+#else
+    return 0;
+#endif
+}
+
+// Converts n samples starting at sample offset of a plane to float
+static void load_samples(const void *plane, int format, size_t offset, float *dst, int n) {
+    if (format == PRECISION_U8) {
+        const unsigned char *src = (const unsigned char *)plane + offset;
+        for (int i = 0; i < n; i++) dst[i] = src[i];
+    } else if (format == PRECISION_I16) {
+        const int16_t *src = (const int16_t *)plane + offset;
+        for (int i = 0; i < n; i++) dst[i] = src[i] * (1.0f / (1 << PRECISION_I16_SHIFT));
+    } else if (format == PRECISION_F16) {
+        const uint16_t *src = (const uint16_t *)plane + offset;
+#ifdef PRECISION_X86
+        if (precision_f16_hardware()) {
+            load_f16c(src, dst, n);
+            return;
+        }
+#endif
+        for (int i = 0; i < n; i++) dst[i] = half_to_float(src[i]);
+    } else {
+        memcpy(dst, (const float *)plane + offset, n * sizeof(float));
+    }
+}
+
+// Stores n samples at sample offset of a plane.  Bytes are clamped and truncated as apply_filter does.
+static void store_samples(const float *src, void *plane, int format, size_t offset, int n) {
+    if (format == PRECISION_U8) {
+        unsigned char *dst = (unsigned char *)plane + offset;
+        for (int i = 0; i < n; i++) {
+            float v = src[i] < 0 ? 0 : src[i];
+            dst[i] = (unsigned char)(int)(v > 255 ? 255 : v);
+        }
+    } else if (format == PRECISION_I16) {
+        int16_t *dst = (int16_t *)plane + offset;
+        for (int i = 0; i < n; i++) {
+            // Offset so the truncating conversion sees only positive values and rounds half up
+            float v = src[i] * (1 << PRECISION_I16_SHIFT) + 32768.5f;
+            v = v < 0.0f ? 0.0f : v;
+            v = v > 65535.0f ? 65535.0f : v;
+            dst[i] = (int16_t)((int)v - 32768);
+        }
+    } else if (format == PRECISION_F16) {
+        uint16_t *dst = (uint16_t *)plane + offset;
+#ifdef PRECISION_X86
+        if (precision_f16_hardware()) {
+            store_f16c(src, dst, n);
+            return;
+        }
+#endif
+        for (int i = 0; i < n; i++) dst[i] = float_to_half(src[i]);
+    } else {
+        memcpy((float *)plane + offset, src, n * sizeof(float));
+    }
+}
+
+// Each band keeps a ring of kernel_size source rows converted to float and padded by half a kernel
+// of clamped pixels on both sides, so every source row is converted once.  Taps are summed in the
+// same order as apply_convolution_rows, which makes U8 chains match chained apply_filter exactly.
+static void precision_rows(void *arg, int start_row, int end_row) {
+    precision_job_t *job = (precision_job_t *)arg;
+    int k = job->kernel_size, half = k / 2, channels = job->channels;
+    int n = job->width * channels, padded = (job->width + 2 * half) * channels;
+    float *ring = malloc((size_t)k * padded * sizeof(float));
+    float *acc = malloc(n * sizeof(float));
+
+    for (int yy = start_row - half; yy < end_row + half; yy++) {
+        int img_y = yy < 0 ? 0 : (yy >= job->height ? job->height - 1 : yy);
+        float *row = ring + (size_t)(((yy % k) + k) % k) * padded;
+        load_samples(job->input, job->input_format, (size_t)img_y * n, row + half * channels, n);
+        for (int x = 0; x < half; x++) {
+            for (int c = 0; c < channels; c++) {
+                row[x * channels + c] = row[half * channels + c];
+                row[(half + job->width + x) * channels + c] = row[(half + job->width - 1) * channels + c];
+            }
+        }
+
+        int y = yy - half;
+        if (y < start_row) continue;
+        for (int i = 0; i < n; i++) acc[i] = 0;
+        for (int ky = 0; ky < k; ky++) {
+            const float *src = ring + (size_t)((((y - half + ky) % k) + k) % k) * padded;
+            for (int kx = 0; kx < k; kx++) {
+                const float *w = job->table + (ky * k + kx) * channels;
+                const float *p = src + kx * channels;
+                if (job->uniform) {
+                    for (int i = 0; i < n; i++) acc[i] += p[i] * w[0];
+                } else {
+                    for (int x = 0; x < job->width; x++) {
+                        for (int c = 0; c < channels; c++) acc[x * channels + c] += p[x * channels + c] * w[c];
+                    }
+                }
+            }
+        }
+        store_samples(acc, job->output, job->output_format, (size_t)y * n, n);
+    }
+
+    free(ring);
+    free(acc);
+}
+
+//apply_chain_precision: Runs num_passes convolutions from input to output, both 8 bit, keeping the
+//                       image between passes in format.  tables[p] holds pass p's weights for every
+//                       band, tap by tap, as build_band_kernel lays them out.
+void apply_chain_precision(unsigned char *input, unsigned char *output, int width, int height, int channels,
+                           float **tables, int kernel_size, int num_passes, int format) {
+    size_t samples = (size_t)width * height * channels;
+    void *planes[2] = {NULL, NULL};
+    if (num_passes > 1) planes[0] = malloc(samples * format_bytes[format]);
+    if (num_passes > 2) planes[1] = malloc(samples * format_bytes[format]);
+
+    for (int p = 0; p < num_passes; p++) {
+        precision_job_t job = {planes[(p + 1) % 2], format, planes[p % 2], format, width, height, channels,
+                               tables[p], kernel_size, 1};
+        if (p == 0) {
+            job.input = input;
+            job.input_format = PRECISION_U8;
+        }
+        if (p == num_passes - 1) {
+            job.output = output;
+            job.output_format = PRECISION_U8;
+        }
+        for (int i = 0; i < kernel_size * kernel_size * channels; i++) {
+            job.uniform = job.uniform && tables[p][i] == tables[p][i - i % channels];
+        }
+        parallel_rows(height, precision_rows, &job);
+    }
+
+    free(planes[0]);
+    free(planes[1]);
+}
@@ -0,0 +1,20 @@
+#ifndef ___PRECISION
+#define ___PRECISION
+#include <stddef.h>
+
+// How a chain of dense kernels stores the image between passes.  U8 clamps and truncates after every
+// pass, as chaining apply_filter does; the others keep what a pass computed, negative or above 255,
+// and only the last pass quantizes to 8 bits.  I16 is fixed point with PRECISION_I16_SHIFT fractional
+// bits, saturating; F16 is IEEE half precision, converted with F16C where the CPU has it.
+enum PrecisionFormats{PRECISION_U8=0,PRECISION_I16=1,PRECISION_F16=2,PRECISION_F32=3,PRECISION_FORMATS=4};
+
+#define PRECISION_I16_SHIFT 4       // steps of 1/16 over -2048..2048
+
+int precision_parse(const char *name);
+const char *precision_name(int format);
+size_t precision_bytes(int format);
+int precision_f16_hardware(void);
+void apply_chain_precision(unsigned char *input, unsigned char *output, int width, int height, int channels,
+                           float **tables, int kernel_size, int num_passes, int format);
+
+#endif
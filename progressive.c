@@ -0,0 +1,61 @@
+// progressive.c - First-rows-out filtering: finished bands are handed on top to bottom as they complete
+#include <stdio.h>
+#include <time.h>
+#include "progressive.h"
+#include "convolve.h"
+
+typedef struct {
+    thread_data_t data;
+    row_task_t rows;
+    int offset;
+} range_job_t;
+
+static void range_rows(void *arg, int start_row, int end_row) {
+    range_job_t *job = (range_job_t *)arg;
+    job->rows(&job->data, start_row + job->offset, end_row + job->offset);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//run_progressive: Runs a chain of convolutions as a wavefront.  To finish a band of the last pass, each
+//                 earlier pass only needs to be kernel_size/2 rows further down per remaining pass, so
+//                 every step advances each pass just that far, all threads working on the topmost rows
+//                 first.  Passes ping-pong between input and scratch: a pass never overwrites rows the
+//                 pass after it still has to read, because that pass is always half a kernel behind.
+//                 Rows handed to the callback are final and stay valid until run_progressive returns.
+//Returns: Whichever of input and scratch holds the finished image
+unsigned char *run_progressive(unsigned char *input, unsigned char *scratch, int width, int height, int channels,
+                               float **kernels, row_task_t *tasks, int num_passes, int kernel_size, int band_rows,
+                               band_callback_t callback, void *ctx, progressive_stats_t *stats) {
+    int half = kernel_size / 2;
+    int done[num_passes];
+    unsigned char *buffers[2] = {input, scratch};
+    unsigned char *result = buffers[num_passes % 2];
+    size_t stride = (size_t)width * channels;
+    double start = now_seconds();
+
+    for (int p = 0; p < num_passes; p++) done[p] = 0;
+    stats->bands = 0;
+    for (int band_start = 0; band_start < height; band_start += band_rows) {
+        int band_end = band_start + band_rows < height ? band_start + band_rows : height;
+        for (int p = 0; p < num_passes; p++) {
+            int target = band_end + (num_passes - 1 - p) * half;
+            if (target > height) target = height;
+            if (target <= done[p]) continue;
+
+            range_job_t job = {{buffers[p % 2], buffers[(p + 1) % 2], width, height, channels, kernels[p], kernel_size},
+                               tasks[p], done[p]};
+            parallel_rows(target - done[p], range_rows, &job);
+            done[p] = target;
+        }
+
+        callback(ctx, result + band_start * stride, band_start, band_end);
+        if (stats->bands++ == 0) stats->first_band = now_seconds() - start;
+    }
+    stats->total = now_seconds() - start;
+    return result;
+}
@@ -0,0 +1,20 @@
+#ifndef ___PROGRESSIVE
+#define ___PROGRESSIVE
+#include "pool.h"
+
+#define PROGRESSIVE_BAND 64
+
+// Receives rows [start_row, end_row) of the finished image; rows points at start_row
+typedef void (*band_callback_t)(void *ctx, const unsigned char *rows, int start_row, int end_row);
+
+typedef struct {
+    double first_band;    // seconds until the first band was handed to the callback
+    double total;         // seconds until the last one was
+    int bands;
+} progressive_stats_t;
+
+unsigned char *run_progressive(unsigned char *input, unsigned char *scratch, int width, int height, int channels,
+                               float **kernels, row_task_t *tasks, int num_passes, int kernel_size, int band_rows,
+                               band_callback_t callback, void *ctx, progressive_stats_t *stats);
+
+#endif
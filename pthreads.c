@@ -3,151 +3,847 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
-#include <pthread.h>
+#include <malloc.h>
+#include "pool.h"
+#include "linear.h"
+#include "unsharp.h"
+#include "iir.h"
+#include "lowrank.h"
+#include "sparse.h"
+#include "temporal.h"
+#include "precision.h"
+#include "canny.h"
+#include "clahe.h"
+#include "integral.h"
+#include "convolve.h"
+#include "batch.h"
+#include "scratch.h"
+#include "memprof.h"
+#include "tilecache.h"
+#include "raw.h"
+#include "plan.h"
+#include "progressive.h"
+#include "png_stream.h"
 
 #define STB_IMAGE_IMPLEMENTATION
+#define STBI_MALLOC(sz) memprof_malloc(MEM_STBI, sz)
+#define STBI_REALLOC(p, newsz) memprof_realloc(MEM_STBI, p, newsz)
+#define STBI_FREE(p) memprof_free(MEM_STBI, p)
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
+#define STBIW_MALLOC(sz) memprof_malloc(MEM_STBIW, sz)
+#define STBIW_REALLOC(p, newsz) memprof_realloc(MEM_STBIW, p, newsz)
+#define STBIW_FREE(p) memprof_free(MEM_STBIW, p)
 #include "stb_image_write.h"
 
-#define NUM_THREADS 4
+typedef struct {
+    int linear;
+    float sigma;
+    float amount;
+    int threshold;
+    float low;
+    float high;
+    int tiles;
+    float clip;
+    int radius;
+    int offset;
+    double tolerance;    // relative error allowed when a user kernel is approximated by separable passes
+    float angle;         // motion blur direction, degrees counterclockwise from the x axis
+    int iterations;      // times the whole chain is run
+    int time_steps;      // iterations of a lone kernel advanced per tile while it is in cache
+    int precision;       // PrecisionFormats value chains of dense kernels keep between passes
+} filter_options_t;
 
+// Set by --raw: the input is headerless multispectral data, and so is the output
 typedef struct {
-    unsigned char *input;
-    unsigned char *output;
     int width;
     int height;
-    int channels;
-    float *kernel;
-    int kernel_size;
-    int start_row;
-    int end_row;
-} thread_data_t;
-
-// Filter kernels
-float edge_kernel[9] = {-1, -1, -1, -1, 8, -1, -1, -1, -1};
-float sharpen_kernel[9] = {0, -1, 0, -1, 5, -1, 0, -1, 0};
-float blur_kernel[9] = {1.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9};
-float gaussian_kernel[9] = {1.0/16, 2.0/16, 1.0/16, 2.0/16, 4.0/16, 2.0/16, 1.0/16, 2.0/16, 1.0/16};
-float emboss_kernel[9] = {-2, -1, 0, -1, 1, 1, 0, 1, 2};
-float identity_kernel[9] = {0, 0, 0, 0, 1, 0, 0, 0, 0};
-
-void *apply_convolution_thread(void *arg) {
-    thread_data_t *data = (thread_data_t *)arg;
-    int kernel_half = data->kernel_size / 2;
-    
-    for (int y = data->start_row; y < data->end_row; y++) {
-        for (int x = 0; x < data->width; x++) {
-            for (int c = 0; c < data->channels; c++) {
-                float sum = 0.0;
-                
-                // Apply kernel
-                for (int ky = -kernel_half; ky <= kernel_half; ky++) {
-                    for (int kx = -kernel_half; kx <= kernel_half; kx++) {
-                        int img_y = y + ky;
-                        int img_x = x + kx;
-                        
-                        // Handle borders by clamping
-                        if (img_y < 0) img_y = 0;
-                        if (img_y >= data->height) img_y = data->height - 1;
-                        if (img_x < 0) img_x = 0;
-                        if (img_x >= data->width) img_x = data->width - 1;
-                        
-                        int pixel_idx = (img_y * data->width + img_x) * data->channels + c;
-                        int kernel_idx = (ky + kernel_half) * data->kernel_size + (kx + kernel_half);
-                        
-                        sum += data->input[pixel_idx] * data->kernel[kernel_idx];
-                    }
-                }
-                
-                // Clamp result to [0, 255]
-                int output_idx = (y * data->width + x) * data->channels + c;
-                data->output[output_idx] = (unsigned char)(fmax(0, fmin(255, sum)));
-            }
+    int bands;      // 0 when the input is a regular image file
+    int planar;
+} raw_format_t;
+
+raw_format_t raw_format = {0, 0, 0, 0};
+
+void free_image(unsigned char *img) {
+    if (raw_format.bands) free(img);
+    else stbi_image_free(img);
+}
+
+// Returns the file name written, or NULL on failure
+const char *write_output(unsigned char *data, int width, int height, int channels) {
+    if (raw_format.bands) {
+        return raw_write("output.raw", data, width, height, channels, raw_format.planar) ? "output.raw" : NULL;
+    }
+    return stbi_write_png("output.png", width, height, channels, data, width * channels) ? "output.png" : NULL;
+}
+
+// Resolves a dense stage into one kernel per band.  A stage is either one kernel name for every band
+// or a slash separated list such as edge/identity, whose kernels repeat across the bands in order.
+// Returns: 1 if the stage is dense, 0 otherwise
+int band_kernels(const char *name, int channels, float **kernels) {
+    char buf[256];
+    float *list[RAW_MAX_BANDS];
+    int count = 0;
+    snprintf(buf, sizeof(buf), "%s", name);
+    for (char *save, *part = strtok_r(buf, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        if (count == RAW_MAX_BANDS || !(list[count++] = lookup_kernel(part))) return 0;
+    }
+    for (int c = 0; c < channels && count; c++) kernels[c] = list[c % count];
+    return count > 0;
+}
+
+// Stages that run as per-band convolutions: explicit per band kernels, and any dense kernel on
+// images with enough bands to fill a vector
+int is_band_stage(const char *name, int channels) {
+    float *kernels[RAW_MAX_BANDS];
+    return band_kernels(name, 1, kernels) && (strchr(name, '/') || channels >= 8);
+}
+
+int is_known_filter(const char *name) {
+    float *kernels[RAW_MAX_BANDS];
+    return band_kernels(name, 1, kernels) || strncmp(name, "kernel:", 7) == 0 || strcmp(name, "unsharp") == 0 || strcmp(name, "highpass") == 0 ||
+           strcmp(name, "iir") == 0 || strcmp(name, "motion") == 0 || strcmp(name, "canny") == 0 || strcmp(name, "clahe") == 0 ||
+           strcmp(name, "box") == 0 || strcmp(name, "variance") == 0 || strcmp(name, "adaptive") == 0;
+}
+
+// A kernel larger than 3x3, read or built once when the chain is set up, with the way it runs chosen
+// then: a uniform line as a running sum, a kernel that is mostly zeros tap by tap, one close to a few
+// separable terms as their sum, otherwise dense.
+typedef struct {
+    float *kernel;       // NULL for stages that aren't large kernels
+    int size;
+    tap_list_t taps;
+    lowrank_t lowrank;
+    int sparse;
+    int separable;
+} large_kernel_t;
+
+// Compiles and decomposes kernel, which lk takes ownership of.  With report set, says which way it
+// will run and what that is projected to save.
+void large_kernel_prepare(large_kernel_t *lk, const char *label, float *kernel, int k, double tolerance,
+                          int report) {
+    lk->kernel = kernel;
+    lk->size = k;
+    taps_compile(kernel, k, &lk->taps);
+    lowrank_decompose(kernel, k, tolerance, &lk->lowrank);
+    lk->separable = lowrank_worthwhile(&lk->lowrank);
+    lk->sparse = !lk->taps.line && lk->taps.count * 2 <= k * k &&
+                 (!lk->separable || lk->taps.count < 2 * lk->lowrank.rank * k);
+    if (!report) return;
+    printf("Kernel %s: %dx%d of rank %d with %d taps, ", label, k, k, lk->lowrank.full_rank, lk->taps.count);
+    if (lk->taps.line) {
+        printf("a uniform line: running sum, 2 reads per sample instead of %d taps\n", k * k);
+    } else if (lk->sparse) {
+        printf("sparse: %d taps instead of %d, projected %.2fx faster\n", lk->taps.count, k * k,
+               (double)(k * k) / lk->taps.count);
+    } else if (lk->separable) {
+        printf("rank %d within %g (error %.2g): %d separable passes, %d taps instead of %d, "
+               "projected %.2fx faster\n", lk->lowrank.rank, tolerance, lk->lowrank.error, lk->lowrank.rank,
+               2 * lk->lowrank.rank * k, k * k, (double)(k * k) / (2 * lk->lowrank.rank * k));
+    } else {
+        printf("needs rank %d within %g, which is no cheaper than %d dense taps\n", lk->lowrank.rank, tolerance,
+               k * k);
+    }
+}
+
+void large_kernel_apply(large_kernel_t *lk, unsigned char *input, unsigned char *output, int width, int height,
+                        int channels) {
+    if (lk->taps.line) apply_filter_line(input, output, width, height, channels, &lk->taps);
+    else if (lk->sparse) apply_filter_taps(input, output, width, height, channels, &lk->taps);
+    else if (lk->separable) apply_filter_lowrank(input, output, width, height, channels, &lk->lowrank);
+    else apply_filter(input, output, width, height, channels, lk->kernel, lk->size);
+}
+
+void large_kernel_free(large_kernel_t *lk) {
+    if (!lk->kernel) return;
+    lowrank_free(&lk->lowrank);
+    taps_free(&lk->taps);
+    free(lk->kernel);
+    lk->kernel = NULL;
+}
+
+// Reads a kernel file, or builds the motion kernel, for a stage that needs one
+// Returns: 0, or -1 if the file isn't a kernel
+int large_kernel_load(large_kernel_t *lk, const char *name, filter_options_t *opts) {
+    char label[64];
+    int k;
+    lk->kernel = NULL;
+    if (strncmp(name, "kernel:", 7) == 0) {
+        float *kernel = read_kernel(name + 7, &k);
+        if (!kernel) return -1;
+        large_kernel_prepare(lk, name + 7, kernel, k, opts->tolerance, 1);
+    } else if (strcmp(name, "motion") == 0) {
+        float *kernel = motion_kernel(opts->radius, opts->angle, &k);
+        snprintf(label, sizeof(label), "motion at %g degrees", opts->angle);
+        large_kernel_prepare(lk, label, kernel, k, 0, 1);
+    }
+    return 0;
+}
+
+// Runs one named filter from input into output.  Both buffers are width*height*channels.  large is the
+// stage's prepared kernel, for kernel files and motion.
+// Returns: 0, or -1 if a stage that needs a prepared kernel has none
+int run_filter(const char *name, large_kernel_t *large, unsigned char *input, unsigned char *output, int width,
+               int height, int channels, filter_options_t *opts) {
+    float *kernel = lookup_kernel(name);
+    float *kernels[RAW_MAX_BANDS];
+    int kernel_size = 3;
+
+    if (is_band_stage(name, channels)) {
+        band_kernels(name, channels, kernels);
+        apply_filter_bands(input, output, width, height, channels, kernels, kernel_size);
+    } else if (strcmp(name, "unsharp") == 0) {
+        apply_unsharp(input, output, width, height, channels, opts->sigma, opts->amount, opts->threshold);
+    } else if (strcmp(name, "highpass") == 0) {
+        apply_highpass(input, output, width, height, channels, opts->sigma);
+    } else if (strncmp(name, "kernel:", 7) == 0 || strcmp(name, "motion") == 0) {
+        if (!large || !large->kernel) return -1;
+        large_kernel_apply(large, input, output, width, height, channels);
+    } else if (strcmp(name, "iir") == 0) {
+        apply_gaussian_iir(input, output, width, height, channels, opts->sigma);
+    } else if (strcmp(name, "canny") == 0) {
+        apply_canny(input, output, width, height, channels, opts->sigma, opts->low, opts->high);
+    } else if (strcmp(name, "clahe") == 0) {
+        apply_clahe(input, output, width, height, channels, opts->tiles, opts->clip);
+    } else if (strcmp(name, "box") == 0) {
+        apply_box(input, output, width, height, channels, opts->radius);
+    } else if (strcmp(name, "variance") == 0) {
+        apply_local_variance(input, output, width, height, channels, opts->radius);
+    } else if (strcmp(name, "adaptive") == 0) {
+        apply_adaptive_threshold(input, output, width, height, channels, opts->radius, opts->offset);
+    } else if (opts->linear) {
+        apply_filter_linear(input, output, width, height, channels, kernel, kernel_size);
+    } else {
+        apply_filter(input, output, width, height, channels, kernel, kernel_size);
+    }
+    return 0;
+}
+
+typedef struct {
+    char **stages;
+    int num_stages;
+    large_kernel_t *large;   // per stage, prepared once when the chain is set up
+    filter_options_t *opts;
+    int profile;             // record each filter as a memprof stage
+} filter_chain_t;
+
+// Runs the chain's filters in order, as many times as opts->iterations says, ping-ponging between
+// the two buffers; both are overwritten.  Dense kernels with wider intermediates than bytes run as one
+// chain in that precision, and a lone 3x3 kernel repeated runs in temporally blocked tiles.
+// Returns whichever buffer holds the final result, or NULL if a stage failed.
+unsigned char *run_chain(filter_chain_t *chain, unsigned char *input, unsigned char *output,
+                         int width, int height, int channels) {
+    unsigned char *src = input;
+    unsigned char *dst = output;
+    char stage_name[64];
+    filter_options_t *opts = chain->opts;
+    float *kernels[RAW_MAX_BANDS];
+    int dense = !opts->linear;
+    for (int i = 0; i < chain->num_stages; i++) dense = dense && band_kernels(chain->stages[i], channels, kernels);
+    if (opts->precision != PRECISION_U8 && dense) {
+        int num_passes = opts->iterations * chain->num_stages;
+        float **tables = malloc(num_passes * sizeof(float *));
+        for (int n = 0; n < num_passes; n++) {
+            band_kernels(chain->stages[n % chain->num_stages], channels, kernels);
+            tables[n] = n < chain->num_stages ? build_band_kernel(kernels, channels, 3) : tables[n % chain->num_stages];
         }
+        if (chain->profile) {
+            snprintf(stage_name, sizeof(stage_name), "filter:%s", precision_name(opts->precision));
+            memprof_stage_begin(stage_name);
+        }
+        apply_chain_precision(input, output, width, height, channels, tables, 3, num_passes, opts->precision);
+        if (chain->profile) memprof_stage_end();
+        for (int n = 0; n < chain->num_stages; n++) free(tables[n]);
+        free(tables);
+        return output;
     }
-    
-    return NULL;
+    if (opts->iterations > 1 && chain->num_stages == 1 && !opts->linear && lookup_kernel(chain->stages[0]) &&
+        !is_band_stage(chain->stages[0], channels)) {
+        if (chain->profile) {
+            snprintf(stage_name, sizeof(stage_name), "filter:%s", chain->stages[0]);
+            memprof_stage_begin(stage_name);
+        }
+        src = apply_filter_iterated(input, output, width, height, channels, lookup_kernel(chain->stages[0]), 3,
+                                    opts->iterations, opts->time_steps);
+        if (chain->profile) memprof_stage_end();
+        return src;
+    }
+    for (int n = 0; n < opts->iterations * chain->num_stages; n++) {
+        const char *name = chain->stages[n % chain->num_stages];
+        if (chain->profile) {
+            snprintf(stage_name, sizeof(stage_name), "filter:%s", name);
+            memprof_stage_begin(stage_name);
+        }
+        int status = run_filter(name, &chain->large[n % chain->num_stages], src, dst, width, height, channels, opts);
+        if (chain->profile) memprof_stage_end();
+        if (status != 0) return NULL;
+        unsigned char *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    return src;
 }
 
-void apply_filter(unsigned char *input, unsigned char *output, int width, int height, 
-                  int channels, float *kernel, int kernel_size) {
-    pthread_t threads[NUM_THREADS];
-    thread_data_t thread_data[NUM_THREADS];
-    
-    int rows_per_thread = height / NUM_THREADS;
-    
-    for (int i = 0; i < NUM_THREADS; i++) {
-        thread_data[i].input = input;
-        thread_data[i].output = output;
-        thread_data[i].width = width;
-        thread_data[i].height = height;
-        thread_data[i].channels = channels;
-        thread_data[i].kernel = kernel;
-        thread_data[i].kernel_size = kernel_size;
-        thread_data[i].start_row = i * rows_per_thread;
-        thread_data[i].end_row = (i == NUM_THREADS - 1) ? height : (i + 1) * rows_per_thread;
-        
-        pthread_create(&threads[i], NULL, apply_convolution_thread, &thread_data[i]);
+// The weights and row task a dense stage runs with.  Per-band stages get a table that the
+// caller releases with free; *owned says whether it did.
+float *stage_kernel(const char *name, int channels, row_task_t *rows, int *owned) {
+    float *kernels[RAW_MAX_BANDS];
+    *owned = is_band_stage(name, channels);
+    if (!*owned) {
+        *rows = apply_convolution_rows;
+        return lookup_kernel(name);
     }
-    
-    for (int i = 0; i < NUM_THREADS; i++) {
-        pthread_join(threads[i], NULL);
+    band_kernels(name, channels, kernels);
+    *rows = apply_band_convolution_rows;
+    return build_band_kernel(kernels, channels, 3);
+}
+
+// Runs a chain of dense kernels with the image held in compressed tile caches, each allowed
+// budget uncompressed bytes, so only a few strips of any intermediate are resident at once.
+// Frees img.  Returns the cache holding the result.
+tile_cache_t *run_chain_tiled(filter_chain_t *chain, unsigned char *img, int width, int height, int channels,
+                              size_t budget) {
+    size_t stride = (size_t)width * channels;
+    // glibc raises its mmap threshold after large frees, after which freed frames stay in the heap
+    // and count against RSS.  Pinning it keeps the decoded image's memory returned once it is tiled.
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+    tile_cache_t *src = tile_cache_create(width, height, channels, budget);
+    for (int t = 0; t < src->num_tiles; t++) {
+        memcpy(tile_cache_get(src, t, 1), img + (size_t)t * TILE_ROWS * stride, tile_cache_rows(src, t) * stride);
+        tile_cache_put(src, t);
+    }
+    free_image(img);
+
+    char name[64];
+    for (int n = 0; n < chain->opts->iterations * chain->num_stages; n++) {
+        const char *stage = chain->stages[n % chain->num_stages];
+        tile_cache_t *dst = tile_cache_create(width, height, channels, budget);
+        row_task_t rows;
+        int owned;
+        float *kernel = stage_kernel(stage, channels, &rows, &owned);
+        convolve_tiles(src, dst, kernel, 3, rows);
+        if (owned) free(kernel);
+        snprintf(name, sizeof(name), "%s input", stage);
+        tile_cache_print_stats(src, name);
+        tile_cache_free(src);
+        src = dst;
+    }
+    return src;
+}
+
+// Streams a tiled result into a PNG one strip at a time, so the whole frame is never assembled
+int write_tiles_png(tile_cache_t *cache, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return 0;
+    png_stream_t *stream = png_stream_begin(cache->width, cache->height, cache->channels, png_write_file, f);
+    for (int t = 0; stream && t < cache->num_tiles; t++) {
+        png_stream_push_rows(stream, tile_cache_get(cache, t, 0), tile_cache_rows(cache, t),
+                             (size_t)cache->width * cache->channels);
+        tile_cache_put(cache, t);
+    }
+    int ok = stream && png_stream_end(stream) && !ferror(f);
+    return fclose(f) == 0 && ok;
+}
+
+// Progressive output is a PNG streamed band by band.  Images PNG can't hold go to a PAM file, a
+// header then plain rows.  Either way every band is written and flushed the moment it is final,
+// so a viewer reading the file shows the image filling in.
+FILE *open_pam(const char *path, int width, int height, int channels) {
+    static const char *tuple_types[] = {"", "GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA"};
+    FILE *f = fopen(path, "wb");
+    if (!f) return NULL;
+    fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\n", width, height, channels);
+    if (channels <= 4) fprintf(f, "TUPLTYPE %s\n", tuple_types[channels]);
+    fprintf(f, "ENDHDR\n");
+    return f;
+}
+
+typedef struct {
+    FILE *file;
+    png_stream_t *png;        // NULL for PAM
+    size_t stride;
+} band_writer_t;
+
+void write_band(void *ctx, const unsigned char *rows, int start_row, int end_row) {
+    band_writer_t *writer = (band_writer_t *)ctx;
+    if (writer->png) png_stream_push_rows(writer->png, rows, end_row - start_row, writer->stride);
+    else fwrite(rows, 1, (end_row - start_row) * writer->stride, writer->file);
+    fflush(writer->file);
+}
+
+// Batch runner callback for out-of-core jobs
+int run_chain_out_of_core(void *ctx, unsigned char *input, int width, int height, int channels, const char *path) {
+    tile_cache_t *result = run_chain_tiled((filter_chain_t *)ctx, input, width, height, channels,
+                                           plan_tile_budget(width, height, channels));
+    int ok = write_tiles_png(result, path);
+    tile_cache_free(result);
+    return ok;
+}
+
+// The budget only refuses jobs when the user set it.  The default is an estimate of what is free, so
+// jobs over it are warned about and run in full.
+void admit_oversized(char **inputs, int count, job_plan_t *plans, size_t budget, int explicit_budget) {
+    for (int i = 0; i < count; i++) {
+        if (plans[i].mode != PLAN_REJECT || explicit_budget) continue;
+        printf("Warning: %s needs about %.0f MB, over the %.0f MB that looks available; running it anyway\n",
+               inputs[i], plans[i].peak_bytes / 1048576.0, budget / 1048576.0);
+        plans[i].mode = PLAN_FULL;
     }
 }
 
+// Batch runner callback: like run_chain, but always leaves the result in output
+int run_chain_into(void *ctx, unsigned char *input, unsigned char *output, int width, int height, int channels) {
+    unsigned char *result = run_chain((filter_chain_t *)ctx, input, output, width, height, channels);
+    if (!result) return 0;
+    if (result != output) memcpy(output, result, (size_t)width * height * channels);
+    return 1;
+}
+
+// Frees the stage list and every stage's prepared kernel
+void release_chain(char *chain, large_kernel_t *large, int num_stages) {
+    for (int i = 0; i < num_stages; i++) large_kernel_free(&large[i]);
+    free(chain);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s <input_image> <filter_type>\n", argv[0]);
-        printf("Filter types: edge, sharpen, blur, gaussian, emboss, identity\n");
+    if (argc < 3) {
+        printf("Usage: %s <input_image> <filter_type>[,<filter_type>...] [options]\n", argv[0]);
+        printf("       %s <list_file> <filter_type>[,<filter_type>...] --batch [--outdir=<dir>] [options]\n", argv[0]);
+        printf("Filter types: edge, sharpen, blur, gaussian, emboss, identity, unsharp, highpass, iir, motion,\n");
+        printf("              canny, clahe, box, variance, adaptive\n");
+        printf("iir is a Gaussian blur of --sigma that costs the same per pixel at any sigma (direct below 2)\n");
+        printf("motion averages 2*radius+1 pixels along a line at --angle\n");
+        printf("kernel:<file> convolves with a square kernel of odd size read from a text file, row by row\n");
+        printf("A comma separated list runs the filters in order, e.g. clahe,edge\n");
+        printf("A slash separated list of kernels gives each band its own, repeating across the bands,\n");
+        printf("e.g. blur/blur/edge\n");
+        printf("Options: --linear         filter in linear light instead of on sRGB values\n");
+        printf("         --sigma=<px>     blur radius for unsharp/highpass/iir/canny (default 1.0)\n");
+        printf("         --amount=<f>     unsharp strength (default 1.0)\n");
+        printf("         --threshold=<n>  unsharp minimum difference, 0-255 (default 0)\n");
+        printf("         --low=<f>        canny weak edge gradient threshold (default 20)\n");
+        printf("         --high=<f>       canny strong edge gradient threshold (default 60)\n");
+        printf("         --tiles=<n>      clahe tiles per side (default 8)\n");
+        printf("         --clip=<f>       clahe clip limit, multiple of the mean bin count (default 2.0)\n");
+        printf("         --radius=<px>    box/variance/adaptive/motion window radius (default 7)\n");
+        printf("         --angle=<deg>    motion direction, counterclockwise from horizontal (default 0)\n");
+        printf("         --iterations=<n> run the whole chain n times (default 1)\n");
+        printf("         --time-steps=<n> iterations of a lone 3x3 kernel each tile advances while in cache;\n");
+        printf("                          1 runs them a full frame at a time (default %d)\n", TEMPORAL_STEPS);
+        printf("         --precision=<f>  what chains of dense kernels keep between passes in memory: u8 (clamped\n");
+        printf("                          bytes, default), i16 (fixed point), f16 (half float) or f32\n");
+        printf("         --offset=<n>     adaptive threshold offset below the local mean (default 5)\n");
+        printf("         --tolerance=<f>  relative error allowed when a kernel file runs as a sum of separable\n");
+        printf("                          passes (default %g)\n", LOWRANK_TOLERANCE);
+        printf("         --raw=<W>x<H>x<B> input is raw 8 bit data with B bands, interleaved by pixel; the\n");
+        printf("                          output is written the same way to output.raw\n");
+        printf("         --planar         raw data is stored one whole band after another\n");
+        printf("         --tile-cache=<MB> hold intermediates of dense kernel chains in compressed strips,\n");
+        printf("                          keeping at most MB uncompressed per image\n");
+        printf("         --mem-budget=<MB> memory jobs are planned against (default 80%% of what the cgroup\n");
+        printf("                          or system has available); larger images run out of core, or are\n");
+        printf("                          refused if the budget was given and warned about otherwise\n");
+        printf("         --plan           print each job's estimated memory, work and mode, then exit\n");
+        printf("         --smt=<mode>     pin threads; off: one per physical core, on: fill SMT siblings first,\n");
+        printf("                          auto: physical cores first, then siblings (default: unpinned)\n");
+        printf("         --progressive[=<rows>] filter dense kernel chains top to bottom in bands (default %d rows),\n",
+               PROGRESSIVE_BAND);
+        printf("                          writing each to output.png as soon as it is done (output.pam for\n");
+        printf("                          raw input)\n");
+        printf("         --pool-stats     report the thread pool's per core type throughput\n");
+        printf("         --json=<file>    write per stage timings and memory use as JSON (- for stdout)\n");
+        printf("         --batch          input is a file listing one image per line, processed in micro-batches\n");
+        printf("         --outdir=<dir>   batch output directory, files are named <stem>_out.png (default .)\n");
+        printf("         --manifest=<f>   batch progress log; a rerun skips work it records (default <outdir>/batch.manifest)\n");
         return 1;
     }
     
     char *input_file = argv[1];
     char *filter_type = argv[2];
+    filter_options_t opts = {0, 1.0f, 1.0f, 0, 20.0f, 60.0f, 8, 2.0f, 7, 5, LOWRANK_TOLERANCE, 0, 1, TEMPORAL_STEPS, PRECISION_U8};
+    int batch = 0;
+    int pool_stats = 0;
+    char *json = NULL;
+    char *outdir = ".";
+    char *manifest_file = NULL;
+    double tile_cache_mb = 0;
+    double mem_budget_mb = 0;
+    int plan_only = 0;
+    int progressive = 0;
+    
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--linear") == 0) {
+            opts.linear = 1;
+        } else if (strncmp(argv[i], "--sigma=", 8) == 0) {
+            opts.sigma = atof(argv[i] + 8);
+        } else if (strncmp(argv[i], "--amount=", 9) == 0) {
+            opts.amount = atof(argv[i] + 9);
+        } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            opts.threshold = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "--low=", 6) == 0) {
+            opts.low = atof(argv[i] + 6);
+        } else if (strncmp(argv[i], "--high=", 7) == 0) {
+            opts.high = atof(argv[i] + 7);
+        } else if (strncmp(argv[i], "--tiles=", 8) == 0) {
+            opts.tiles = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--clip=", 7) == 0) {
+            opts.clip = atof(argv[i] + 7);
+        } else if (strncmp(argv[i], "--radius=", 9) == 0) {
+            opts.radius = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--offset=", 9) == 0) {
+            opts.offset = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--tolerance=", 12) == 0) {
+            opts.tolerance = atof(argv[i] + 12);
+        } else if (strncmp(argv[i], "--angle=", 8) == 0) {
+            opts.angle = atof(argv[i] + 8);
+        } else if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            opts.iterations = atoi(argv[i] + 13);
+            if (opts.iterations < 1) {
+                printf("--iterations needs at least 1\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--time-steps=", 13) == 0) {
+            opts.time_steps = atoi(argv[i] + 13);
+            if (opts.time_steps < 1) {
+                printf("--time-steps needs at least 1\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--raw=", 6) == 0) {
+            if (sscanf(argv[i] + 6, "%dx%dx%d", &raw_format.width, &raw_format.height, &raw_format.bands) != 3 ||
+                raw_format.width <= 0 || raw_format.height <= 0 || raw_format.bands <= 0 ||
+                raw_format.bands > RAW_MAX_BANDS) {
+                printf("Invalid raw format %s, expected <width>x<height>x<bands> with up to %d bands\n",
+                       argv[i] + 6, RAW_MAX_BANDS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--planar") == 0) {
+            raw_format.planar = 1;
+        } else if (strncmp(argv[i], "--tile-cache=", 13) == 0) {
+            tile_cache_mb = atof(argv[i] + 13);
+        } else if (strncmp(argv[i], "--mem-budget=", 13) == 0) {
+            mem_budget_mb = atof(argv[i] + 13);
+        } else if (strcmp(argv[i], "--progressive") == 0) {
+            progressive = PROGRESSIVE_BAND;
+        } else if (strncmp(argv[i], "--progressive=", 14) == 0) {
+            progressive = atoi(argv[i] + 14);
+            if (progressive < 1) {
+                printf("Invalid band height: %s\n", argv[i] + 14);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--plan") == 0) {
+            plan_only = 1;
+        } else if (strncmp(argv[i], "--smt=", 6) == 0) {
+            int mode = pool_parse_smt(argv[i] + 6);
+            if (mode < 0) {
+                printf("Unknown SMT mode: %s\n", argv[i] + 6);
+                return 1;
+            }
+            pool_set_smt(mode);
+        } else if (strncmp(argv[i], "--precision=", 12) == 0) {
+            opts.precision = precision_parse(argv[i] + 12);
+            if (opts.precision < 0) {
+                printf("Unknown precision: %s\n", argv[i] + 12);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--pool-stats") == 0) {
+            pool_stats = 1;
+        } else if (strncmp(argv[i], "--json=", 7) == 0) {
+            json = argv[i] + 7;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = 1;
+        } else if (strncmp(argv[i], "--outdir=", 9) == 0) {
+            outdir = argv[i] + 9;
+        } else if (strncmp(argv[i], "--manifest=", 11) == 0) {
+            manifest_file = argv[i] + 11;
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    
+    char *stages[32];
+    large_kernel_t large[32];
+    int num_stages = 0;
+    char *chain = strdup(filter_type);
+    for (char *name = strtok(chain, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (!is_known_filter(name)) {
+            printf("Unknown filter type: %s\n", name);
+            free(chain);
+            return 1;
+        }
+        if (opts.linear && (strcmp(name, "unsharp") == 0 || strcmp(name, "highpass") == 0)) {
+            printf("--linear isn't supported by %s, which works on sRGB values\n", name);
+            free(chain);
+            return 1;
+        }
+        if (num_stages == 32) {
+            printf("Too many filters in chain (max 32)\n");
+            free(chain);
+            return 1;
+        }
+        // Kernel files are read and decomposed here, once, not per image or iteration
+        if (large_kernel_load(&large[num_stages], name, &opts) != 0) {
+            printf("Error reading kernel %s, expected an odd square number of weights\n", name + 7);
+            release_chain(chain, large, num_stages);
+            return 1;
+        }
+        stages[num_stages++] = name;
+    }
+    if (num_stages == 0) {
+        printf("Unknown filter type: %s\n", filter_type);
+        release_chain(chain, large, num_stages);
+        return 1;
+    }
+    
+    filter_chain_t filters = {stages, num_stages, large, &opts, json != NULL};
+    
+    // Plans are made from image headers before anything is decoded
+    float *kernels[RAW_MAX_BANDS];
+    plan_chain_t plan_chain = {stages, num_stages, opts.linear, opts.sigma, !opts.linear, opts.iterations,
+                              opts.precision};
+    for (int i = 0; i < num_stages; i++) plan_chain.dense = plan_chain.dense && band_kernels(stages[i], 1, kernels);
+    if (opts.precision != PRECISION_U8 && !plan_chain.dense) {
+        printf("--precision only applies to chains of dense kernels, keeping 8 bit intermediates\n");
+        opts.precision = plan_chain.precision = PRECISION_U8;
+    }
+    // Wider intermediates are whole frames, so those chains don't run out of core
+    plan_chain.dense = plan_chain.dense && opts.precision == PRECISION_U8;
+    size_t budget = mem_budget_mb > 0 ? (size_t)(mem_budget_mb * 1048576) : plan_memory_budget();
+    
+    if (batch && raw_format.bands) {
+        printf("--raw isn't supported in batch mode\n");
+        release_chain(chain, large, num_stages);
+        return 1;
+    }
+    
+    if (batch) {
+        int count;
+        filters.profile = 0;
+        char **inputs = read_batch_list(input_file, &count);
+        if (!inputs) {
+            printf("Error reading batch list %s\n", input_file);
+            release_chain(chain, large, num_stages);
+            return 1;
+        }
+        job_plan_t *plans = malloc(count * sizeof(job_plan_t));
+        plan_jobs(inputs, count, &plan_chain, budget, plans);
+        if (plan_only) {
+            plan_print(inputs, count, plans, budget, 1);
+            free(plans);
+            free_batch_list(inputs, count);
+            release_chain(chain, large, num_stages);
+            return 0;
+        }
+        admit_oversized(inputs, count, plans, budget, mem_budget_mb > 0);
+        
+        // Completed outputs are only reused by a run with the same filters and options
+        char manifest_path[4096], signature[8192];
+        manifest_t manifest;
+        if (!manifest_file) {
+            snprintf(manifest_path, sizeof(manifest_path), "%s/batch.manifest", outdir);
+            manifest_file = manifest_path;
+        }
+        size_t used = snprintf(signature, sizeof(signature), "%s linear=%d sigma=%g amount=%g threshold=%d "
+                               "low=%g high=%g tiles=%d clip=%g radius=%d offset=%d tolerance=%g angle=%g "
+                               "iterations=%d precision=%s", filter_type, opts.linear, opts.sigma, opts.amount,
+                               opts.threshold, opts.low, opts.high, opts.tiles, opts.clip, opts.radius, opts.offset,
+                               opts.tolerance, opts.angle, opts.iterations, precision_name(opts.precision));
+        // Kernel files are named by path, so the weights loaded from them go in too: editing one redoes
+        // its outputs
+        for (int i = 0; i < num_stages && used < sizeof(signature); i++) {
+            if (strncmp(stages[i], "kernel:", 7) != 0) continue;
+            used += snprintf(signature + used, sizeof(signature) - used, " %s=%016llx", stages[i],
+                             hash_bytes((const unsigned char *)large[i].kernel,
+                                        (size_t)large[i].size * large[i].size * sizeof(float)));
+        }
+        // A cut off signature could match a different chain's, so it isn't recorded at all
+        if (used >= sizeof(signature)) {
+            printf("Filter chain too long to record in a manifest (max %d characters)\n", (int)sizeof(signature) - 1);
+            free(plans);
+            free_batch_list(inputs, count);
+            release_chain(chain, large, num_stages);
+            return 1;
+        }
+        if (manifest_open(&manifest, manifest_file, signature) != 0) {
+            printf("Error opening manifest %s\n", manifest_file);
+            free(plans);
+            free_batch_list(inputs, count);
+            release_chain(chain, large, num_stages);
+            return 1;
+        }
+        
+        batch_config_t config = {NULL, 3, run_chain_into, &filters, outdir, &manifest, plans, budget,
+                                 run_chain_out_of_core};
+        // A lone dense kernel can be streamed and lane-packed across images
+        if (num_stages == 1 && !opts.linear && opts.iterations == 1 && opts.precision == PRECISION_U8) {
+            config.kernel = lookup_kernel(stages[0]);
+        }
+        
+        printf("Applying %s filter to %d images in micro-batches using pthreads with %d threads...\n",
+               filter_type, count, NUM_THREADS);
+        int failed = run_batch(inputs, count, &config);
+        printf("Outputs saved to %s (%d failed)\n", outdir, failed);
+        if (pool_stats) pool_print_stats();
+        
+        manifest_close(&manifest);
+        free(plans);
+        free_batch_list(inputs, count);
+        release_chain(chain, large, num_stages);
+        return failed ? 1 : 0;
+    }
+    
+    // A regular image too large to filter in memory runs out of core, unless it won't fit at all
+    if (!raw_format.bands) {
+        job_plan_t plan;
+        plan_job(input_file, &plan_chain, budget, &plan);
+        if (plan_only) {
+            plan_print(&input_file, 1, &plan, budget, 1);
+            release_chain(chain, large, num_stages);
+            return 0;
+        }
+        admit_oversized(&input_file, 1, &plan, budget, mem_budget_mb > 0);
+        if (plan.mode == PLAN_REJECT) {
+            printf("Error: %s needs about %.0f MB, over the %.0f MB budget\n", input_file,
+                   plan.peak_bytes / 1048576.0, budget / 1048576.0);
+            release_chain(chain, large, num_stages);
+            return 1;
+        }
+        if (plan.mode == PLAN_OUT_OF_CORE && tile_cache_mb <= 0) {
+            tile_cache_mb = plan_tile_budget(plan.width, plan.height, plan.channels) / 1048576.0;
+        }
+    }
     
     int width, height, channels;
-    unsigned char *img = stbi_load(input_file, &width, &height, &channels, 0);
+    unsigned char *img;
+    if (json) memprof_stage_begin("decode");
+    if (raw_format.bands) {
+        width = raw_format.width;
+        height = raw_format.height;
+        channels = raw_format.bands;
+        img = raw_load(input_file, width, height, channels, raw_format.planar);
+    } else {
+        img = stbi_load(input_file, &width, &height, &channels, 0);
+    }
+    if (json) memprof_stage_end();
     
     if (img == NULL) {
         printf("Error loading image %s\n", input_file);
+        release_chain(chain, large, num_stages);
         return 1;
     }
     
     printf("Loaded image: %dx%d with %d channels\n", width, height, channels);
     
-    unsigned char *output = (unsigned char *)malloc(width * height * channels);
-    
-    float *kernel = NULL;
-    int kernel_size = 3;
-    
-    if (strcmp(filter_type, "edge") == 0) {
-        kernel = edge_kernel;
-    } else if (strcmp(filter_type, "sharpen") == 0) {
-        kernel = sharpen_kernel;
-    } else if (strcmp(filter_type, "blur") == 0) {
-        kernel = blur_kernel;
-    } else if (strcmp(filter_type, "gaussian") == 0) {
-        kernel = gaussian_kernel;
-    } else if (strcmp(filter_type, "emboss") == 0) {
-        kernel = emboss_kernel;
-    } else if (strcmp(filter_type, "identity") == 0) {
-        kernel = identity_kernel;
-    } else {
-        printf("Unknown filter type: %s\n", filter_type);
-        stbi_image_free(img);
-        free(output);
+    int dense = 1;
+    for (int i = 0; i < num_stages; i++) dense = dense && band_kernels(stages[i], channels, kernels);
+    // The other filters and the linear light path are written for gray, RGB and RGBA pixels
+    if (channels > 4 && (!dense || opts.linear)) {
+        printf("Images with more than 4 channels support only dense kernels, without --linear\n");
+        free_image(img);
+        release_chain(chain, large, num_stages);
         return 1;
     }
+    dense = dense && !opts.linear;
+    if (progressive && (!dense || opts.iterations > 1 || opts.precision != PRECISION_U8)) {
+        printf("--progressive only applies to chains of dense kernels run once with 8 bit intermediates, "
+               "running the whole image\n");
+    } else if (progressive) {
+        printf("Applying %s filter progressively in %d row bands using pthreads with %d threads...\n",
+               filter_type, progressive, NUM_THREADS);
+        float *weights[32];
+        row_task_t tasks[32];
+        int owned[32];
+        for (int i = 0; i < num_stages; i++) weights[i] = stage_kernel(stages[i], channels, &tasks[i], &owned[i]);
+        unsigned char *scratch = (unsigned char *)memprof_malloc(MEM_ENGINE, (size_t)width * height * channels);
+        const char *saved = raw_format.bands ? "output.pam" : "output.png";
+        band_writer_t writer = {NULL, NULL, (size_t)width * channels};
+        if (raw_format.bands) {
+            writer.file = open_pam(saved, width, height, channels);
+        } else if ((writer.file = fopen(saved, "wb"))) {
+            writer.png = png_stream_begin(width, height, channels, png_write_file, writer.file);
+        }
+        int ok = 0;
+        if (writer.file && (raw_format.bands || writer.png)) {
+            progressive_stats_t stats;
+            run_progressive(img, scratch, width, height, channels, weights, tasks, num_stages, 3, progressive,
+                            write_band, &writer, &stats);
+            ok = (!writer.png || png_stream_end(writer.png)) && !ferror(writer.file);
+            printf("First band out after %.2f ms, all %d bands after %.2f ms\n", stats.first_band * 1e3,
+                   stats.bands, stats.total * 1e3);
+        } else if (writer.png) {
+            png_stream_end(writer.png);
+        }
+        if (writer.file) ok = fclose(writer.file) == 0 && ok;
+        // A short file, from a full disk say, is not left behind looking like a result
+        if (ok) {
+            printf("Output saved to %s\n", saved);
+        } else {
+            printf("Error writing %s\n", saved);
+            if (writer.file) remove(saved);
+        }
+        if (pool_stats) pool_print_stats();
+        for (int i = 0; i < num_stages; i++) {
+            if (owned[i]) free(weights[i]);
+        }
+        memprof_free(MEM_ENGINE, scratch);
+        free_image(img);
+        if (json) memprof_write_json(json, input_file, width, height, channels);
+        release_chain(chain, large, num_stages);
+        return ok ? 0 : 1;
+    }
+    if (tile_cache_mb > 0 && (!dense || opts.precision != PRECISION_U8)) {
+        printf("--tile-cache only applies to chains of dense kernels with 8 bit intermediates, running in memory\n");
+    } else if (tile_cache_mb > 0) {
+        printf("Applying %s filter in tiles using pthreads with %d threads...\n", filter_type, NUM_THREADS);
+        tile_cache_t *result = run_chain_tiled(&filters, img, width, height, channels,
+                                               (size_t)(tile_cache_mb * 1048576));
+        tile_cache_print_stats(result, "output");
+        
+        const char *saved = NULL;
+        if (!raw_format.bands) {
+            saved = write_tiles_png(result, "output.png") ? "output.png" : NULL;
+            if (!saved) remove("output.png");
+        } else {
+            // Planar raw output needs every row of a band before the next band starts
+            unsigned char *output = (unsigned char *)memprof_malloc(MEM_ENGINE, (size_t)width * height * channels);
+            tile_cache_read_rows(result, 0, height, output);
+            saved = write_output(output, width, height, channels);
+            memprof_free(MEM_ENGINE, output);
+        }
+        tile_cache_free(result);
+        if (saved) printf("Output saved to %s\n", saved);
+        else printf("Error writing output\n");
+        if (json) memprof_write_json(json, input_file, width, height, channels);
+        release_chain(chain, large, num_stages);
+        return saved ? 0 : 1;
+    }
     
-    printf("Applying %s filter using pthreads with %d threads...\n", filter_type, NUM_THREADS);
-    apply_filter(img, output, width, height, channels, kernel, kernel_size);
+    if (json) memprof_stage_begin("allocate");
+    unsigned char *output = (unsigned char *)memprof_malloc(MEM_ENGINE, (size_t)width * height * channels);
+    if (json) memprof_stage_end();
     
-    stbi_write_png("output.png", width, height, channels, output, width * channels);
-    printf("Output saved to output.png\n");
+    printf("Applying %s filter using pthreads with %d threads%s...\n", filter_type, NUM_THREADS,
+           opts.linear ? " in linear light" : "");
     
-    stbi_image_free(img);
-    free(output);
+    // Chained filters ping-pong between the decoded image and the output buffer
+    unsigned char *result = run_chain(&filters, img, output, width, height, channels);
+    if (pool_stats) pool_print_stats();
     
-    return 0;
-}
\ No newline at end of file
+    const char *saved = NULL;
+    if (result) {
+        if (json) memprof_stage_begin("encode");
+        saved = write_output(result, width, height, channels);
+        if (json) memprof_stage_end();
+    }
+    scratch_release();
+    if (saved) printf("Output saved to %s\n", saved);
+    else if (result) printf("Error writing output\n");
+    else printf("Error applying %s filter\n", filter_type);
+    
+    free_image(img);
+    memprof_free(MEM_ENGINE, output);
+    if (json) memprof_write_json(json, input_file, width, height, channels);
+    release_chain(chain, large, num_stages);
+    
+    return saved ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+// rapl.c - Reads RAPL energy counters through /sys/class/powercap
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include "rapl.h"
+
+#define POWERCAP_DIR "/sys/class/powercap"
+
+static int read_counter(const char *path, unsigned long long *value) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fscanf(f, "%llu", value) == 1;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+//rapl_open: Finds every readable package zone (intel-rapl:N, not its intel-rapl:N:M subzones, which
+//           would be counted twice).  AMD CPUs publish the same interface.  A zone whose wrap point
+//           can't be read is skipped, since a wrapped reading from it couldn't be corrected.
+//Returns: The number of usable zones; when 0, rapl->reason says why
+int rapl_open(rapl_t *rapl) {
+    char path[RAPL_PATH_MAX];
+    rapl->count = 0;
+    strcpy(rapl->reason, "no intel-rapl zones under " POWERCAP_DIR);
+
+    DIR *dir = opendir(POWERCAP_DIR);
+    if (!dir) {
+        snprintf(rapl->reason, sizeof(rapl->reason), "%s: %s", POWERCAP_DIR, strerror(errno));
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && rapl->count < RAPL_MAX_ZONES) {
+        int zone, used;
+        if (sscanf(entry->d_name, "intel-rapl:%d%n", &zone, &used) != 1 || entry->d_name[used] != 0) continue;
+
+        unsigned long long value;
+        snprintf(path, sizeof(path), "%s/%s/energy_uj", POWERCAP_DIR, entry->d_name);
+        if (read_counter(path, &value) != 0) {
+            snprintf(rapl->reason, sizeof(rapl->reason), "%s: %s", path, strerror(errno));
+            continue;
+        }
+        strcpy(rapl->paths[rapl->count], path);
+        snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj", POWERCAP_DIR, entry->d_name);
+        errno = 0;
+        if (read_counter(path, &rapl->max_range[rapl->count]) != 0 || rapl->max_range[rapl->count] == 0) {
+            snprintf(rapl->reason, sizeof(rapl->reason), "%s: %s", path, errno ? strerror(errno) : "unreadable");
+            continue;
+        }
+        rapl->count++;
+    }
+    closedir(dir);
+    return rapl->count;
+}
+
+//rapl_read: Samples every zone's counter into energy[0..count)
+//Returns: 0 on success, -1 if a counter couldn't be read
+int rapl_read(rapl_t *rapl, unsigned long long *energy) {
+    for (int i = 0; i < rapl->count; i++) {
+        if (read_counter(rapl->paths[i], &energy[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+//rapl_joules: Energy used by all zones between two samples, allowing for one counter wrap per zone
+double rapl_joules(rapl_t *rapl, unsigned long long *start, unsigned long long *end) {
+    double total = 0;
+    for (int i = 0; i < rapl->count; i++) {
+        unsigned long long used = end[i] >= start[i] ? end[i] - start[i] : rapl->max_range[i] - start[i] + end[i];
+        total += used * 1e-6;
+    }
+    return total;
+}
@@ -0,0 +1,19 @@
+#ifndef ___RAPL
+#define ___RAPL
+
+#define RAPL_MAX_ZONES 16
+#define RAPL_PATH_MAX 320   // the powercap directory, a zone's directory name of up to 255 bytes, a file name
+
+// Package-level RAPL energy counters from the powercap sysfs interface
+typedef struct {
+    int count;
+    char paths[RAPL_MAX_ZONES][RAPL_PATH_MAX];
+    unsigned long long max_range[RAPL_MAX_ZONES];  // counter wrap point, in microjoules
+    char reason[RAPL_PATH_MAX + 64];               // why no zone is usable, when count is 0
+} rapl_t;
+
+int rapl_open(rapl_t *rapl);
+int rapl_read(rapl_t *rapl, unsigned long long *energy);
+double rapl_joules(rapl_t *rapl, unsigned long long *start, unsigned long long *end);
+
+#endif
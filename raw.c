@@ -0,0 +1,56 @@
+// raw.c - Raw multispectral input and output
+#include <stdio.h>
+#include <stdlib.h>
+#include "raw.h"
+
+//raw_load: Reads a width x height image of the given number of bands
+//Returns: The interleaved samples, or NULL if the file can't be read or is the wrong size
+unsigned char *raw_load(const char *path, int width, int height, int bands, int planar) {
+    size_t pixels = (size_t)width * height;
+    size_t bytes = pixels * bands;
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 0 || (size_t)size != bytes) {
+        fclose(f);
+        return NULL;
+    }
+
+    unsigned char *data = malloc(bytes);
+    unsigned char *file = planar ? malloc(bytes) : data;
+    int ok = fread(file, 1, bytes, f) == bytes;
+    fclose(f);
+    if (ok && planar) {
+        for (int b = 0; b < bands; b++) {
+            for (size_t i = 0; i < pixels; i++) data[i * bands + b] = file[b * pixels + i];
+        }
+    }
+    if (planar) free(file);
+    if (!ok) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+//raw_write: Writes interleaved samples back out in the requested layout
+//Returns: 1 on success, 0 on failure
+int raw_write(const char *path, unsigned char *data, int width, int height, int bands, int planar) {
+    size_t pixels = (size_t)width * height;
+    size_t bytes = pixels * bands;
+    FILE *f = fopen(path, "wb");
+    if (!f) return 0;
+
+    unsigned char *file = data;
+    if (planar) {
+        file = malloc(bytes);
+        for (int b = 0; b < bands; b++) {
+            for (size_t i = 0; i < pixels; i++) file[b * pixels + i] = data[i * bands + b];
+        }
+    }
+    int ok = fwrite(file, 1, bytes, f) == bytes;
+    if (planar) free(file);
+    return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,12 @@
+#ifndef ___RAW
+#define ___RAW
+
+#define RAW_MAX_BANDS 64
+
+// Headerless 8 bit multispectral data.  Interleaved files store all bands of a pixel together;
+// planar files store each band as a whole image, one after another.  In memory, images are
+// always interleaved like the stb loaders' output.
+unsigned char *raw_load(const char *path, int width, int height, int bands, int planar);
+int raw_write(const char *path, unsigned char *data, int width, int height, int bands, int planar);
+
+#endif
@@ -0,0 +1,197 @@
+// regress.c - Baseline storage and statistical comparison of benchmark results
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "regress.h"
+
+//save_results: Writes results as JSON, one combination per line with every raw sample kept
+//Returns: 0 on success, -1 if the file can't be written
+int save_results(const char *path, bench_result_t *results, int count) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fprintf(f, "{\n  \"results\": [\n");
+    for (int i = 0; i < count; i++) {
+        bench_result_t *r = &results[i];
+        fprintf(f, "    {\"image\": \"%s\", \"filter\": \"%s\", \"backend\": \"%s\", \"seconds\": [",
+                r->image, r->filter, r->backend);
+        for (int s = 0; s < r->runs; s++) fprintf(f, "%s%.9f", s ? ", " : "", r->seconds[s]);
+        fprintf(f, "]}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+// Finds "key": within [obj, end) and returns a pointer just past the colon, or NULL
+static const char *find_key(const char *obj, const char *end, const char *key) {
+    char quoted[64];
+    snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+    const char *p = strstr(obj, quoted);
+    if (!p || p >= end) return NULL;
+    p += strlen(quoted);
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    return (p < end && *p == ':') ? p + 1 : NULL;
+}
+
+static int read_string(const char *obj, const char *end, const char *key, char *out, size_t size) {
+    const char *p = find_key(obj, end, key);
+    if (!p) return -1;
+    while (p < end && *p != '"') p++;
+    const char *close = p < end ? strchr(p + 1, '"') : NULL;
+    if (!close || close >= end || (size_t)(close - p - 1) >= size) return -1;
+    memcpy(out, p + 1, close - p - 1);
+    out[close - p - 1] = 0;
+    return 0;
+}
+
+//load_results: Reads a file written by save_results
+//Returns: The results (release with free), or NULL if the file can't be read or parsed
+bench_result_t *load_results(const char *path, int *count) {
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = malloc(size + 1);
+    size_t got = fread(text, 1, size, f);
+    text[got] = 0;
+    fclose(f);
+
+    int capacity = 16;
+    bench_result_t *results = malloc(capacity * sizeof(bench_result_t));
+    *count = 0;
+    for (const char *obj = strstr(text, "{\"image\""); obj; obj = strstr(obj + 1, "{\"image\"")) {
+        const char *end = strchr(obj, '}');
+        if (!end) break;
+        if (*count == capacity) {
+            capacity *= 2;
+            results = realloc(results, capacity * sizeof(bench_result_t));
+        }
+        bench_result_t *r = &results[*count];
+        memset(r, 0, sizeof(*r));
+        const char *samples = find_key(obj, end, "seconds");
+        if (read_string(obj, end, "image", r->image, sizeof(r->image)) != 0 ||
+            read_string(obj, end, "filter", r->filter, sizeof(r->filter)) != 0 ||
+            read_string(obj, end, "backend", r->backend, sizeof(r->backend)) != 0 || !samples) {
+            free(results);
+            free(text);
+            return NULL;
+        }
+        samples = strchr(samples, '[');
+        while (samples && samples < end && r->runs < REGRESS_MAX_RUNS) {
+            char *next;
+            double value = strtod(samples + 1, &next);
+            if (next == samples + 1) break;
+            r->seconds[r->runs++] = value;
+            samples = next;
+            while (*samples == ' ') samples++;
+            if (*samples != ',') break;
+        }
+        (*count)++;
+    }
+    free(text);
+    return results;
+}
+
+typedef struct {
+    double value;
+    int group;
+} ranked_t;
+
+static int compare_ranked(const void *a, const void *b) {
+    double da = ((const ranked_t *)a)->value, db = ((const ranked_t *)b)->value;
+    return (da > db) - (da < db);
+}
+
+//mann_whitney_p: Two-sided p-value of the Mann-Whitney U test that a and b come from the same
+//                distribution, using the normal approximation with tie and continuity corrections
+double mann_whitney_p(double *a, int na, double *b, int nb) {
+    int n = na + nb;
+    if (na == 0 || nb == 0) return 1;
+    ranked_t *all = malloc(n * sizeof(ranked_t));
+    for (int i = 0; i < na; i++) all[i] = (ranked_t){a[i], 0};
+    for (int i = 0; i < nb; i++) all[na + i] = (ranked_t){b[i], 1};
+    qsort(all, n, sizeof(ranked_t), compare_ranked);
+
+    double rank_sum = 0, ties = 0;
+    for (int i = 0; i < n; ) {
+        int j = i;
+        while (j < n && all[j].value == all[i].value) j++;
+        double rank = (i + 1 + j) / 2.0;     // average of ranks i+1 .. j
+        for (int k = i; k < j; k++) {
+            if (all[k].group == 0) rank_sum += rank;
+        }
+        double t = j - i;
+        ties += t * t * t - t;
+        i = j;
+    }
+    free(all);
+
+    double u = rank_sum - na * (na + 1) / 2.0;
+    double mean = na * (double)nb / 2;
+    double var = na * (double)nb / 12 * ((n + 1) - ties / ((double)n * (n - 1)));
+    if (var <= 0) return 1;
+    double z = (fabs(u - mean) - 0.5) / sqrt(var);
+    if (z < 0) z = 0;
+    return erfc(z / sqrt(2));
+}
+
+static double median_of(double *values, int n) {
+    double sorted[REGRESS_MAX_RUNS];
+    memcpy(sorted, values, n * sizeof(double));
+    for (int i = 1; i < n; i++) {
+        for (int j = i; j > 0 && sorted[j - 1] > sorted[j]; j--) {
+            double t = sorted[j];
+            sorted[j] = sorted[j - 1];
+            sorted[j - 1] = t;
+        }
+    }
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+//write_comparison: Writes a markdown table comparing current against baseline.  A combination is a
+//                  regression when its median is more than threshold percent slower and the
+//                  Mann-Whitney test rejects "same distribution" at level alpha.
+//Returns: The number of regressions
+int write_comparison(FILE *f, const char *baseline_path, bench_result_t *baseline, int baseline_count,
+                     bench_result_t *current, int current_count, double threshold, double alpha) {
+    int regressions = 0, improvements = 0, unchanged = 0, missing = 0;
+
+    fprintf(f, "## Benchmark comparison\n\n");
+    fprintf(f, "Baseline `%s`, threshold %.1f%%, Mann-Whitney alpha %.3f\n\n", baseline_path, threshold, alpha);
+    fprintf(f, "| image | filter | backend | baseline ms | current ms | change | p | verdict |\n");
+    fprintf(f, "|---|---|---|---:|---:|---:|---:|---|\n");
+    for (int i = 0; i < current_count; i++) {
+        bench_result_t *cur = &current[i], *base = NULL;
+        for (int j = 0; j < baseline_count && !base; j++) {
+            if (strcmp(baseline[j].image, cur->image) == 0 && strcmp(baseline[j].filter, cur->filter) == 0 &&
+                strcmp(baseline[j].backend, cur->backend) == 0) base = &baseline[j];
+        }
+        double cur_ms = median_of(cur->seconds, cur->runs) * 1e3;
+        if (!base || base->runs == 0) {
+            fprintf(f, "| %s | %s | %s | - | %.2f | - | - | not in baseline |\n", cur->image, cur->filter,
+                    cur->backend, cur_ms);
+            missing++;
+            continue;
+        }
+
+        double base_ms = median_of(base->seconds, base->runs) * 1e3;
+        double change = (cur_ms / base_ms - 1) * 100;
+        double p = mann_whitney_p(base->seconds, base->runs, cur->seconds, cur->runs);
+        const char *verdict = "unchanged";
+        if (p < alpha && change > threshold) {
+            verdict = "**REGRESSION**";
+            regressions++;
+        } else if (p < alpha && change < -threshold) {
+            verdict = "improved";
+            improvements++;
+        } else {
+            unchanged++;
+        }
+        fprintf(f, "| %s | %s | %s | %.2f | %.2f | %+.1f%% | %.4f | %s |\n", cur->image, cur->filter,
+                cur->backend, base_ms, cur_ms, change, p, verdict);
+    }
+    fprintf(f, "\n%d regressions, %d improvements, %d unchanged, %d not in baseline\n",
+            regressions, improvements, unchanged, missing);
+    return regressions;
+}
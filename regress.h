@@ -0,0 +1,23 @@
+#ifndef ___REGRESS
+#define ___REGRESS
+#include <stdio.h>
+
+#define REGRESS_MAX_RUNS 100
+
+// Timings of one image x filter x backend combination
+typedef struct {
+    char image[64];
+    char filter[32];
+    char backend[32];
+    double seconds[REGRESS_MAX_RUNS];
+    double joules[REGRESS_MAX_RUNS];
+    int runs;
+} bench_result_t;
+
+int save_results(const char *path, bench_result_t *results, int count);
+bench_result_t *load_results(const char *path, int *count);
+double mann_whitney_p(double *a, int na, double *b, int nb);
+int write_comparison(FILE *f, const char *baseline_path, bench_result_t *baseline, int baseline_count,
+                     bench_result_t *current, int current_count, double threshold, double alpha);
+
+#endif
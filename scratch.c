@@ -0,0 +1,63 @@
+// scratch.c - Thread-local block cache used as the PNG encoder's allocator
+#include <stdlib.h>
+#include <string.h>
+#include "scratch.h"
+
+#define SCRATCH_SLOTS 16
+
+typedef union {
+    size_t capacity;
+    max_align_t align;
+} scratch_header_t;
+
+static __thread scratch_header_t *cache[SCRATCH_SLOTS];
+
+void *scratch_malloc(size_t size) {
+    int best = -1;
+    for (int i = 0; i < SCRATCH_SLOTS; i++) {
+        if (cache[i] && cache[i]->capacity >= size &&
+            (best < 0 || cache[i]->capacity < cache[best]->capacity)) best = i;
+    }
+    if (best >= 0) {
+        scratch_header_t *block = cache[best];
+        cache[best] = NULL;
+        return block + 1;
+    }
+
+    scratch_header_t *block = malloc(sizeof(scratch_header_t) + size);
+    if (!block) return NULL;
+    block->capacity = size;
+    return block + 1;
+}
+
+void scratch_free(void *ptr) {
+    if (!ptr) return;
+    scratch_header_t *block = (scratch_header_t *)ptr - 1;
+    for (int i = 0; i < SCRATCH_SLOTS; i++) {
+        if (!cache[i]) {
+            cache[i] = block;
+            return;
+        }
+    }
+    free(block);
+}
+
+void *scratch_realloc(void *ptr, size_t size) {
+    if (!ptr) return scratch_malloc(size);
+    scratch_header_t *block = (scratch_header_t *)ptr - 1;
+    if (block->capacity >= size) return ptr;
+
+    void *grown = scratch_malloc(size);
+    if (!grown) return NULL;
+    memcpy(grown, ptr, block->capacity);
+    scratch_free(ptr);
+    return grown;
+}
+
+//scratch_release: Frees every block cached by the calling thread.  Call before the thread exits.
+void scratch_release(void) {
+    for (int i = 0; i < SCRATCH_SLOTS; i++) {
+        free(cache[i]);
+        cache[i] = NULL;
+    }
+}
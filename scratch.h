@@ -0,0 +1,13 @@
+#ifndef ___SCRATCH
+#define ___SCRATCH
+#include <stddef.h>
+
+// Per-thread recycling allocator.  Freed blocks are kept in a small cache and handed back to the
+// next request they are big enough for, so a thread encoding image after image reuses the same
+// filter rows, hash tables and output buffers instead of going back to malloc each time.
+void *scratch_malloc(size_t size);
+void *scratch_realloc(void *ptr, size_t size);
+void scratch_free(void *ptr);
+void scratch_release(void);
+
+#endif
@@ -0,0 +1,200 @@
+// sparse.c - Kernels that are mostly zeros, such as motion blurs and other directional kernels
+//
+// A dense loop visits all k*k weights of a kernel whose non-zero taps may be a single line.  Here
+// the taps are compiled once into offsets and weights and only those are visited.  Uniform line
+// kernels go further: neighbouring outputs along the line share all but two of their inputs, so
+// a running sum needs two reads per sample whatever the length.
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "sparse.h"
+#include "pool.h"
+
+typedef struct {
+    unsigned char *input;
+    unsigned char *output;
+    int width;
+    int height;
+    int channels;
+    const tap_list_t *taps;
+} taps_job_t;
+
+//taps_compile: Collects the kernel's non-zero taps as offsets from its centre, and recognises
+//              a line of equal taps
+//Returns: The number of taps
+int taps_compile(const float *kernel, int kernel_size, tap_list_t *taps) {
+    int half = kernel_size / 2;
+    memset(taps, 0, sizeof(tap_list_t));
+    for (int i = 0; i < kernel_size * kernel_size; i++) taps->count += kernel[i] != 0;
+    taps->dx = malloc((taps->count ? taps->count : 1) * sizeof(int));
+    taps->dy = malloc((taps->count ? taps->count : 1) * sizeof(int));
+    taps->weights = malloc((taps->count ? taps->count : 1) * sizeof(float));
+
+    int n = 0;
+    for (int ky = 0; ky < kernel_size; ky++) {
+        for (int kx = 0; kx < kernel_size; kx++) {
+            if (kernel[ky * kernel_size + kx] == 0) continue;
+            taps->dx[n] = kx - half;
+            taps->dy[n] = ky - half;
+            taps->weights[n] = kernel[ky * kernel_size + kx];
+            if (abs(kx - half) > taps->reach_x) taps->reach_x = abs(kx - half);
+            if (abs(ky - half) > taps->reach_y) taps->reach_y = abs(ky - half);
+            n++;
+        }
+    }
+
+    // Taps come out in row-major order, which is the order of t along a line whose step points
+    // down, or right if the line is horizontal, so every tap must be one step past the previous
+    if (n < 2) return n;
+    int step_x = taps->dx[1] - taps->dx[0], step_y = taps->dy[1] - taps->dy[0];
+    for (int i = 0; i < n; i++) {
+        if (taps->dx[i] != taps->dx[0] + i * step_x || taps->dy[i] != taps->dy[0] + i * step_y ||
+            fabsf(taps->weights[i] - taps->weights[0]) > 1e-6f * fabsf(taps->weights[0])) {
+            return n;
+        }
+    }
+    int first = step_x ? taps->dx[0] / step_x : taps->dy[0] / step_y;
+    if (first * step_x != taps->dx[0] || first * step_y != taps->dy[0]) return n;
+    taps->line = 1;
+    taps->step_x = step_x;
+    taps->step_y = step_y;
+    taps->first = first;
+    taps->last = first + n - 1;
+    return n;
+}
+
+void taps_free(tap_list_t *taps) {
+    free(taps->dx);
+    free(taps->dy);
+    free(taps->weights);
+}
+
+//motion_kernel: Averages along a line through the centre, radius pixels each way along its longer
+//               axis, at angle degrees counterclockwise from the x axis
+//Returns: A (2*radius+1)^2 kernel, to release with free
+float *motion_kernel(int radius, float angle, int *kernel_size) {
+    double c = cos(angle * M_PI / 180), s = sin(angle * M_PI / 180);
+    double major = fmax(fabs(c), fabs(s));
+    int k = 2 * radius + 1;
+    float *kernel = calloc((size_t)k * k, sizeof(float));
+    for (int t = -radius; t <= radius; t++) {
+        int dx = (int)lround(t * c / major), dy = (int)lround(-t * s / major);
+        kernel[(dy + radius) * k + dx + radius] = 1.0f / k;
+    }
+    *kernel_size = k;
+    return kernel;
+}
+
+static inline unsigned char clamped(const taps_job_t *job, int x, int y, int c) {
+    if (x < 0) x = 0;
+    if (x >= job->width) x = job->width - 1;
+    if (y < 0) y = 0;
+    if (y >= job->height) y = job->height - 1;
+    return job->input[((size_t)y * job->width + x) * job->channels + c];
+}
+
+// Rows accumulate tap by tap.  Where every tap lands inside the image the tap is one offset
+// from the output sample, so each is a straight multiply-add over the run; the few samples near
+// the borders clamp each tap as apply_filter does.
+static void taps_rows(void *arg, int start_row, int end_row) {
+    taps_job_t *job = (taps_job_t *)arg;
+    const tap_list_t *taps = job->taps;
+    int channels = job->channels;
+    int n = job->width * channels;
+    int x0 = taps->reach_x, x1 = job->width - taps->reach_x;
+    float *sum = malloc(n * sizeof(float));
+
+    for (int y = start_row; y < end_row; y++) {
+        int inside = y - taps->reach_y >= 0 && y + taps->reach_y < job->height && x0 < x1;
+        int lo = inside ? x0 : 0, hi = inside ? x1 : 0;
+        for (int i = 0; i < n; i++) sum[i] = 0;
+        for (int t = 0; inside && t < taps->count; t++) {
+            float w = taps->weights[t];
+            const unsigned char *src = job->input + ((size_t)(y + taps->dy[t]) * job->width + taps->dx[t]) * channels;
+            for (int i = lo * channels; i < hi * channels; i++) sum[i] += w * src[i];
+        }
+        for (int x = 0; x < job->width; x++) {
+            if (x >= lo && x < hi) continue;
+            for (int c = 0; c < channels; c++) {
+                for (int t = 0; t < taps->count; t++) {
+                    sum[x * channels + c] += taps->weights[t] * clamped(job, x + taps->dx[t], y + taps->dy[t], c);
+                }
+            }
+        }
+        unsigned char *out = job->output + (size_t)y * n;
+        for (int i = 0; i < n; i++) out[i] = (unsigned char)(fmaxf(0, fminf(255, sum[i])));
+    }
+    free(sum);
+}
+
+// One sample of line_rows, clamping every read
+static inline void line_sum(const taps_job_t *job, int32_t *cur, const int32_t *prev, int x, int y, int no_prev) {
+    const tap_list_t *taps = job->taps;
+    int sx = taps->step_x, sy = taps->step_y, px = x - sx, py = y - sy, channels = job->channels;
+    for (int c = 0; c < channels; c++) {
+        if (no_prev || px < 0 || px >= job->width) {
+            int32_t s = 0;
+            for (int t = taps->first; t <= taps->last; t++) s += clamped(job, x + t * sx, y + t * sy, c);
+            cur[x * channels + c] = s;
+        } else {
+            cur[x * channels + c] = prev[px * channels + c] -
+                                    clamped(job, px + taps->first * sx, py + taps->first * sy, c) +
+                                    clamped(job, x + taps->last * sx, y + taps->last * sy, c);
+        }
+    }
+}
+
+// The line's sum at (x, y) is the sum at (x, y) - step with the input at its first tap dropped and
+// the one past its last added.  Sums are exact integers, kept for the last step_y + 1 rows; a sum
+// whose predecessor is outside the image or above the band is added up in full.  Where the
+// predecessor and both inputs are inside the image, that is three reads at fixed offsets.
+static void line_rows(void *arg, int start_row, int end_row) {
+    taps_job_t *job = (taps_job_t *)arg;
+    const tap_list_t *taps = job->taps;
+    int channels = job->channels, n = job->width * channels;
+    int sx = taps->step_x, sy = taps->step_y, ring_rows = sy + 1;
+    float weight = taps->weights[0];
+    int32_t *ring = malloc((size_t)ring_rows * n * sizeof(int32_t));
+    // x + a must land inside the row for a = -sx (predecessor), (first-1)*sx (dropped), last*sx (added)
+    int offsets[3] = {-sx, (taps->first - 1) * sx, taps->last * sx};
+    int lo = 0, hi = job->width;
+    for (int i = 0; i < 3; i++) {
+        if (-offsets[i] > lo) lo = -offsets[i];
+        if (job->width - offsets[i] < hi) hi = job->width - offsets[i];
+    }
+
+    for (int y = start_row; y < end_row; y++) {
+        int32_t *cur = ring + (size_t)(y % ring_rows) * n;
+        int py = y - sy;
+        int32_t *prev = ring + (size_t)(((py % ring_rows) + ring_rows) % ring_rows) * n;
+        int fast = py >= start_row && py + taps->first * sy >= 0 && y + taps->last * sy < job->height;
+        int x0 = fast && lo < hi ? lo : job->width, x1 = fast && lo < hi ? hi : job->width;
+        // Left to right, as a horizontal line's predecessor is earlier in the same row
+        for (int x = 0; x < x0; x++) line_sum(job, cur, prev, x, y, py < start_row);
+        if (x0 < x1) {
+            const unsigned char *drop = job->input + ((size_t)(py + taps->first * sy) * job->width + offsets[1]) * channels;
+            const unsigned char *add = job->input + ((size_t)(y + taps->last * sy) * job->width + offsets[2]) * channels;
+            const int32_t *from = prev - sx * channels;
+            for (int i = x0 * channels; i < x1 * channels; i++) cur[i] = from[i] - drop[i] + add[i];
+        }
+        for (int x = x1; x < job->width; x++) line_sum(job, cur, prev, x, y, py < start_row);
+        unsigned char *out = job->output + (size_t)y * n;
+        for (int i = 0; i < n; i++) out[i] = (unsigned char)(fmaxf(0, fminf(255, cur[i] * weight)));
+    }
+    free(ring);
+}
+
+//apply_filter_taps: Convolves with a compiled tap list; the cost is proportional to its taps
+void apply_filter_taps(unsigned char *input, unsigned char *output, int width, int height,
+                       int channels, const tap_list_t *taps) {
+    taps_job_t job = {input, output, width, height, channels, taps};
+    parallel_rows(height, taps_rows, &job);
+}
+
+//apply_filter_line: Convolves with a uniform line (taps->line set) as a running sum along it
+void apply_filter_line(unsigned char *input, unsigned char *output, int width, int height,
+                       int channels, const tap_list_t *taps) {
+    taps_job_t job = {input, output, width, height, channels, taps};
+    parallel_rows(height, line_rows, &job);
+}
@@ -0,0 +1,29 @@
+#ifndef ___SPARSE
+#define ___SPARSE
+
+// A kernel's non-zero taps.  When they are evenly spaced along a line and all weigh the same, as
+// in a motion blur along 0, 45 or 90 degrees, they are also described as the line t*(step_x, step_y)
+// for t from first to last, which apply_filter_line runs as a running sum.
+typedef struct {
+    int count;
+    int *dx;
+    int *dy;
+    float *weights;
+    int reach_x;          // largest |dx| and |dy|
+    int reach_y;
+    int line;
+    int step_x;           // step_y > 0, or step_y == 0 and step_x > 0
+    int step_y;
+    int first;
+    int last;
+} tap_list_t;
+
+int taps_compile(const float *kernel, int kernel_size, tap_list_t *taps);
+void taps_free(tap_list_t *taps);
+float *motion_kernel(int radius, float angle, int *kernel_size);
+void apply_filter_taps(unsigned char *input, unsigned char *output, int width, int height,
+                       int channels, const tap_list_t *taps);
+void apply_filter_line(unsigned char *input, unsigned char *output, int width, int height,
+                       int channels, const tap_list_t *taps);
+
+#endif
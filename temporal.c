@@ -0,0 +1,137 @@
+// temporal.c - Repeated application of one kernel with temporal blocking
+//
+// Iterating a small kernel pass by pass streams the whole frame through memory twice per pass, and
+// for a 3x3 kernel that traffic, not the arithmetic, sets the pace.  Here the frame is cut into
+// tiles, and each tile copies in enough of a halo to advance several passes on its own while it
+// sits in cache.  Every pass invalidates kernel_size/2 more samples around the edge of the copy,
+// so each is computed over a smaller region than the last: a trapezoid in space and time.  Results
+// are the same as running the passes one after another.
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "temporal.h"
+#include "pool.h"
+
+typedef struct {
+    unsigned char *input;
+    unsigned char *output;
+    int width;
+    int height;
+    int channels;
+    float *kernel;
+    int kernel_size;
+    int steps;            // passes this round
+    int tiles_x;
+} temporal_job_t;
+
+// Output row y, columns [x0, x1), of a width x height image, with borders clamped.  Taps are summed in
+// the same order as apply_convolution_rows so results match it exactly, but each tap runs across the
+// row, which in the interior is a straight vector multiply-add.
+static void convolve_row(const unsigned char *restrict src, unsigned char *dst, int width, int height, int channels,
+                         const float *kernel, int kernel_size, int y, int x0, int x1, float *restrict acc) {
+    int half = kernel_size / 2;
+    int ia = half > x0 ? half : x0, ib = width - half < x1 ? width - half : x1;
+    if (ia > x1) ia = x1;
+    if (ib < ia) ib = ia;
+
+    for (int i = x0 * channels; i < x1 * channels; i++) acc[i] = 0;
+    for (int ky = -half; ky <= half; ky++) {
+        int img_y = y + ky < 0 ? 0 : (y + ky >= height ? height - 1 : y + ky);
+        const unsigned char *row = src + (size_t)img_y * width * channels;
+        for (int kx = -half; kx <= half; kx++) {
+            float w = kernel[(ky + half) * kernel_size + kx + half];
+            const unsigned char *p = row + kx * channels;
+            for (int i = ia * channels; i < ib * channels; i++) acc[i] += p[i] * w;
+            for (int x = x0; x < x1; x++) {
+                if (x == ia) x = ib;
+                if (x >= x1) break;
+                int img_x = x + kx < 0 ? 0 : (x + kx >= width ? width - 1 : x + kx);
+                for (int c = 0; c < channels; c++) acc[x * channels + c] += row[img_x * channels + c] * w;
+            }
+        }
+    }
+    unsigned char *out = dst + (size_t)y * width * channels;
+    // Comparisons rather than fmaxf/fminf, whose NaN handling keeps them out of line, so this vectorizes
+    for (int i = x0 * channels; i < x1 * channels; i++) {
+        float v = acc[i] < 0 ? 0 : acc[i];
+        out[i] = (unsigned char)(int)(v > 255 ? 255 : v);
+    }
+}
+
+// One pass over whole frames, the untiled schedule
+static void frame_rows(void *arg, int start_row, int end_row) {
+    temporal_job_t *job = (temporal_job_t *)arg;
+    float *acc = malloc((size_t)job->width * job->channels * sizeof(float));
+    for (int y = start_row; y < end_row; y++) {
+        convolve_row(job->input, job->output, job->width, job->height, job->channels, job->kernel,
+                     job->kernel_size, y, 0, job->width, acc);
+    }
+    free(acc);
+}
+
+// Advances tiles [start, end) by job->steps passes.  A tile's copy reaches steps*half past it on
+// every side that isn't an image border; at an image border the copy's edge is the image's, so
+// clamping to it is exact and nothing there goes stale.
+static void tile_rows(void *arg, int start, int end) {
+    temporal_job_t *job = (temporal_job_t *)arg;
+    int channels = job->channels, halo = job->steps * (job->kernel_size / 2);
+    size_t capacity = (size_t)(TEMPORAL_TILE_ROWS + 2 * halo) * (TEMPORAL_TILE_COLS + 2 * halo) * channels;
+    unsigned char *a = malloc(capacity), *b = malloc(capacity);
+    float *acc = malloc((size_t)(TEMPORAL_TILE_COLS + 2 * halo) * channels * sizeof(float));
+
+    for (int t = start; t < end; t++) {
+        int y0 = t / job->tiles_x * TEMPORAL_TILE_ROWS, x0 = t % job->tiles_x * TEMPORAL_TILE_COLS;
+        int y1 = y0 + TEMPORAL_TILE_ROWS < job->height ? y0 + TEMPORAL_TILE_ROWS : job->height;
+        int x1 = x0 + TEMPORAL_TILE_COLS < job->width ? x0 + TEMPORAL_TILE_COLS : job->width;
+        int ly0 = y0 - halo > 0 ? y0 - halo : 0, ly1 = y1 + halo < job->height ? y1 + halo : job->height;
+        int lx0 = x0 - halo > 0 ? x0 - halo : 0, lx1 = x1 + halo < job->width ? x1 + halo : job->width;
+        int lw = lx1 - lx0, lh = ly1 - ly0;
+        for (int y = 0; y < lh; y++) {
+            memcpy(a + (size_t)y * lw * channels, job->input + ((size_t)(ly0 + y) * job->width + lx0) * channels,
+                   (size_t)lw * channels);
+        }
+
+        for (int s = 1; s <= job->steps; s++) {
+            int shrink = s * (job->kernel_size / 2);
+            int top = ly0 > 0 ? shrink : 0, bottom = ly1 < job->height ? lh - shrink : lh;
+            int left = lx0 > 0 ? shrink : 0, right = lx1 < job->width ? lw - shrink : lw;
+            for (int y = top; y < bottom; y++) {
+                convolve_row(a, b, lw, lh, channels, job->kernel, job->kernel_size, y, left, right, acc);
+            }
+            unsigned char *tmp = a;
+            a = b;
+            b = tmp;
+        }
+
+        for (int y = y0; y < y1; y++) {
+            memcpy(job->output + ((size_t)y * job->width + x0) * channels,
+                   a + ((size_t)(y - ly0) * lw + x0 - lx0) * channels, (size_t)(x1 - x0) * channels);
+        }
+    }
+
+    free(a);
+    free(b);
+    free(acc);
+}
+
+//apply_filter_iterated: Convolves iterations times, ping-ponging between input and scratch, in rounds
+//                       of up to steps passes per tile.  With steps of 1 every pass is a full frame.
+//                       Both buffers are overwritten.
+//Returns: Whichever of input and scratch holds the result
+unsigned char *apply_filter_iterated(unsigned char *input, unsigned char *scratch, int width, int height,
+                                     int channels, float *kernel, int kernel_size, int iterations, int steps) {
+    unsigned char *src = input, *dst = scratch;
+    int tiles_x = (width + TEMPORAL_TILE_COLS - 1) / TEMPORAL_TILE_COLS;
+    int tiles_y = (height + TEMPORAL_TILE_ROWS - 1) / TEMPORAL_TILE_ROWS;
+    for (int done = 0; done < iterations; ) {
+        int round = iterations - done < steps ? iterations - done : steps;
+        temporal_job_t job = {src, dst, width, height, channels, kernel, kernel_size, round, tiles_x};
+        if (round <= 1) parallel_rows(height, frame_rows, &job);
+        else parallel_rows(tiles_x * tiles_y, tile_rows, &job);
+        done += round > 1 ? round : 1;
+        unsigned char *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    return src;
+}
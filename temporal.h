@@ -0,0 +1,11 @@
+#ifndef ___TEMPORAL
+#define ___TEMPORAL
+
+#define TEMPORAL_STEPS 8            // default iterations each tile advances before it is written back
+#define TEMPORAL_TILE_ROWS 128      // tile size, before the halo the steps need around it
+#define TEMPORAL_TILE_COLS 512
+
+unsigned char *apply_filter_iterated(unsigned char *input, unsigned char *scratch, int width, int height,
+                                     int channels, float *kernel, int kernel_size, int iterations, int steps);
+
+#endif
@@ -0,0 +1,208 @@
+// tilecache.c - Compressed strip cache for running filter chains on images larger than memory
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tilecache.h"
+#include "convolve.h"
+#include "lz.h"
+#include "pool.h"
+
+static size_t tile_bytes(tile_cache_t *cache, int tile) {
+    return (size_t)tile_cache_rows(cache, tile) * cache->width * cache->channels;
+}
+
+static void note_peak(tile_cache_t *cache) {
+    if (cache->hot_bytes + cache->packed_bytes > cache->peak_bytes) {
+        cache->peak_bytes = cache->hot_bytes + cache->packed_bytes;
+    }
+}
+
+tile_cache_t *tile_cache_create(int width, int height, int channels, size_t budget) {
+    tile_cache_t *cache = calloc(1, sizeof(tile_cache_t));
+    cache->width = width;
+    cache->height = height;
+    cache->channels = channels;
+    cache->num_tiles = (height + TILE_ROWS - 1) / TILE_ROWS;
+    cache->budget = budget;
+    cache->tiles = calloc(cache->num_tiles, sizeof(tile_t));
+    size_t full = (size_t)TILE_ROWS * width * channels;
+    cache->scratch = malloc(full + LZ_BOUND(full));   // delta coded rows, then their compressed form
+    return cache;
+}
+
+int tile_cache_rows(tile_cache_t *cache, int tile) {
+    int rows = cache->height - tile * TILE_ROWS;
+    return rows < TILE_ROWS ? rows : TILE_ROWS;
+}
+
+// Neighbouring pixels are close in value, so coding each byte as the difference from the same
+// channel one pixel to the left turns smooth areas into runs the compressor can match
+static void delta_encode(tile_cache_t *cache, const unsigned char *src, unsigned char *dst, int rows) {
+    int stride = cache->width * cache->channels;
+    for (int y = 0; y < rows; y++) {
+        const unsigned char *s = src + (size_t)y * stride;
+        unsigned char *d = dst + (size_t)y * stride;
+        for (int i = 0; i < cache->channels; i++) d[i] = s[i];
+        for (int i = cache->channels; i < stride; i++) d[i] = (unsigned char)(s[i] - s[i - cache->channels]);
+    }
+}
+
+static void delta_decode(tile_cache_t *cache, unsigned char *data, int rows) {
+    int stride = cache->width * cache->channels;
+    for (int y = 0; y < rows; y++) {
+        unsigned char *d = data + (size_t)y * stride;
+        for (int i = cache->channels; i < stride; i++) d[i] = (unsigned char)(d[i] + d[i - cache->channels]);
+    }
+}
+
+// Drops a tile's uncompressed copy, compressing it first unless a valid compressed copy exists
+static void evict(tile_cache_t *cache, int index) {
+    tile_t *tile = &cache->tiles[index];
+    size_t bytes = tile_bytes(cache, index);
+
+    if (!tile->packed_size) {
+        unsigned char *delta = cache->scratch;
+        unsigned char *packed = cache->scratch + (size_t)TILE_ROWS * cache->width * cache->channels;
+        delta_encode(cache, tile->data, delta, tile_cache_rows(cache, index));
+        int size = lz_compress(delta, (int)bytes, packed, LZ_BOUND(bytes));
+        tile->packed = malloc(size);
+        memcpy(tile->packed, packed, size);
+        tile->packed_size = size;
+        cache->packed_bytes += size;
+        cache->compressions++;
+        cache->raw_in += bytes;
+        cache->packed_out += size;
+    }
+    free(tile->data);
+    tile->data = NULL;
+    cache->hot_bytes -= bytes;
+}
+
+// Evicts least recently used unpinned tiles until another `bytes` fit in the budget.  If every hot
+// tile is pinned the budget is exceeded rather than failing.
+static void make_room(tile_cache_t *cache, size_t bytes) {
+    while (cache->hot_bytes + bytes > cache->budget) {
+        int victim = -1;
+        for (int i = 0; i < cache->num_tiles; i++) {
+            tile_t *tile = &cache->tiles[i];
+            if (tile->data && !tile->pins && (victim < 0 || tile->last_use < cache->tiles[victim].last_use)) {
+                victim = i;
+            }
+        }
+        if (victim < 0) return;
+        evict(cache, victim);
+    }
+}
+
+//tile_cache_get: Pins a tile and returns its uncompressed rows, decompressing it if it was cold.
+//                With write set the caller is going to overwrite the tile, so it isn't decompressed
+//                and its compressed copy is discarded.  Every get is matched by a tile_cache_put.
+unsigned char *tile_cache_get(tile_cache_t *cache, int index, int write) {
+    tile_t *tile = &cache->tiles[index];
+    size_t bytes = tile_bytes(cache, index);
+
+    tile->last_use = ++cache->clock;
+    tile->pins++;
+    if (tile->data) {
+        cache->hits++;
+    } else {
+        make_room(cache, bytes);
+        tile->data = malloc(bytes);
+        cache->hot_bytes += bytes;
+        if (tile->packed_size && !write) {
+            lz_decompress(tile->packed, tile->packed_size, tile->data, (int)bytes);
+            delta_decode(cache, tile->data, tile_cache_rows(cache, index));
+            cache->misses++;
+        } else if (!write) {
+            memset(tile->data, 0, bytes);
+        }
+    }
+    if (write && tile->packed_size) {
+        free(tile->packed);
+        cache->packed_bytes -= tile->packed_size;
+        tile->packed = NULL;
+        tile->packed_size = 0;
+    }
+    note_peak(cache);
+    return tile->data;
+}
+
+void tile_cache_put(tile_cache_t *cache, int index) {
+    cache->tiles[index].pins--;
+}
+
+//tile_cache_read_rows: Copies rows [start_row, end_row) out of whichever tiles hold them
+void tile_cache_read_rows(tile_cache_t *cache, int start_row, int end_row, unsigned char *dst) {
+    size_t stride = (size_t)cache->width * cache->channels;
+    for (int y = start_row; y < end_row; ) {
+        int index = y / TILE_ROWS;
+        int stop = (index + 1) * TILE_ROWS < end_row ? (index + 1) * TILE_ROWS : end_row;
+        unsigned char *data = tile_cache_get(cache, index, 0);
+        memcpy(dst + (y - start_row) * stride, data + (size_t)(y - index * TILE_ROWS) * stride, (stop - y) * stride);
+        tile_cache_put(cache, index);
+        y = stop;
+    }
+}
+
+void tile_cache_print_stats(tile_cache_t *cache, const char *name) {
+    long fetches = cache->hits + cache->misses;
+    printf("Tile cache %s: %d tiles, hit ratio %.1f%% (%ld of %ld), %ld compressions, ratio %.2f:1, "
+           "peak %.1f MB of %.1f MB uncompressed\n", name, cache->num_tiles,
+           fetches ? 100.0 * cache->hits / fetches : 100.0, cache->hits, fetches, cache->compressions,
+           cache->packed_out ? (double)cache->raw_in / cache->packed_out : 1.0, cache->peak_bytes / 1048576.0,
+           (double)cache->width * cache->height * cache->channels / 1048576.0);
+}
+
+void tile_cache_free(tile_cache_t *cache) {
+    for (int i = 0; i < cache->num_tiles; i++) {
+        free(cache->tiles[i].data);
+        free(cache->tiles[i].packed);
+    }
+    free(cache->tiles);
+    free(cache->scratch);
+    free(cache);
+}
+
+typedef struct {
+    thread_data_t data;   // covers the window of rows around one output tile
+    int offset;           // window row of the tile's first row
+    row_task_t rows;
+} window_job_t;
+
+static void convolve_window_rows(void *arg, int start_row, int end_row) {
+    window_job_t *job = (window_job_t *)arg;
+    job->rows(&job->data, start_row + job->offset, end_row + job->offset);
+}
+
+//convolve_tiles: Convolves input into output one tile at a time.  Each tile is computed from a window
+//                holding it and the kernel's halo rows from its neighbours, so only a few tiles of each
+//                cache are needed at once.  At the image edges the window ends, which gives the same
+//                clamping as apply_filter.  rows is the thread_data_t row task to run, either
+//                apply_convolution_rows or apply_band_convolution_rows with its band kernel table.
+void convolve_tiles(tile_cache_t *input, tile_cache_t *output, float *kernel, int kernel_size, row_task_t rows) {
+    int half = kernel_size / 2;
+    size_t stride = (size_t)input->width * input->channels;
+    size_t window_bytes = (TILE_ROWS + 2 * half) * stride;
+    unsigned char *window = malloc(window_bytes);
+    unsigned char *result = malloc(window_bytes);
+    window_job_t job = {{window, result, input->width, 0, input->channels, kernel, kernel_size}, 0, rows};
+
+    for (int t = 0; t < input->num_tiles; t++) {
+        int start = t * TILE_ROWS;
+        int end = start + tile_cache_rows(input, t);
+        int window_start = start - half > 0 ? start - half : 0;
+        int window_end = end + half < input->height ? end + half : input->height;
+        tile_cache_read_rows(input, window_start, window_end, window);
+
+        job.data.height = window_end - window_start;
+        job.offset = start - window_start;
+        parallel_rows(end - start, convolve_window_rows, &job);
+
+        unsigned char *dst = tile_cache_get(output, t, 1);
+        memcpy(dst, result + job.offset * stride, (end - start) * stride);
+        tile_cache_put(output, t);
+    }
+
+    free(window);
+    free(result);
+}
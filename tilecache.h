@@ -0,0 +1,49 @@
+#ifndef ___TILECACHE
+#define ___TILECACHE
+#include <stddef.h>
+#include "pool.h"
+
+#define TILE_ROWS 64
+
+// One full-width strip of rows.  While hot it lives uncompressed in data; once evicted only the
+// compressed copy remains.  A clean hot tile keeps its compressed copy, so evicting it again is free.
+typedef struct {
+    unsigned char *data;
+    unsigned char *packed;
+    int packed_size;          // 0 if there is no valid compressed copy
+    int pins;
+    unsigned long last_use;
+} tile_t;
+
+// Holds one image as strips under a budget for uncompressed bytes.  Not thread safe: tiles are
+// fetched and returned by one thread, and the work on each tile is what runs in parallel.
+typedef struct {
+    int width;
+    int height;
+    int channels;
+    int num_tiles;
+    size_t budget;
+    size_t hot_bytes;
+    size_t packed_bytes;
+    size_t peak_bytes;        // of hot_bytes + packed_bytes
+    unsigned long clock;
+    long hits;                // fetches that found the tile uncompressed
+    long misses;              // fetches that had to decompress it
+    long compressions;
+    size_t raw_in;            // bytes fed to the compressor, and what came out
+    size_t packed_out;
+    tile_t *tiles;
+    unsigned char *scratch;
+} tile_cache_t;
+
+tile_cache_t *tile_cache_create(int width, int height, int channels, size_t budget);
+int tile_cache_rows(tile_cache_t *cache, int tile);
+unsigned char *tile_cache_get(tile_cache_t *cache, int tile, int write);
+void tile_cache_put(tile_cache_t *cache, int tile);
+void tile_cache_read_rows(tile_cache_t *cache, int start_row, int end_row, unsigned char *dst);
+void tile_cache_print_stats(tile_cache_t *cache, const char *name);
+void tile_cache_free(tile_cache_t *cache);
+
+void convolve_tiles(tile_cache_t *input, tile_cache_t *output, float *kernel, int kernel_size, row_task_t rows);
+
+#endif
@@ -0,0 +1,126 @@
+// unsharp.c - Unsharp mask and high-pass filters built on a separable Gaussian blur
+#include <stdlib.h>
+#include <math.h>
+#include "unsharp.h"
+#include "pool.h"
+
+typedef struct {
+    unsigned char *input;
+    unsigned char *output;
+    int width;
+    int height;
+    int channels;
+    float *weights;      // 2*radius+1 normalized Gaussian taps
+    int radius;
+    float amount;
+    int threshold;
+    int highpass;
+} unsharp_job_t;
+
+// Blurs one source row horizontally into dst (width*channels floats)
+static void blur_row(unsharp_job_t *job, int y, float *dst) {
+    int channels = job->channels;
+    unsigned char *src = job->input + (size_t)y * job->width * channels;
+
+    for (int x = 0; x < job->width; x++) {
+        for (int c = 0; c < channels; c++) {
+            float sum = 0;
+            for (int k = -job->radius; k <= job->radius; k++) {
+                int img_x = x + k;
+                if (img_x < 0) img_x = 0;
+                if (img_x >= job->width) img_x = job->width - 1;
+                sum += src[img_x * channels + c] * job->weights[k + job->radius];
+            }
+            dst[x * channels + c] = sum;
+        }
+    }
+}
+
+// Each band keeps a ring of 2*radius+1 horizontally blurred rows.  Moving down one row costs one
+// new horizontal pass, the vertical pass reads the ring, and the result is combined with the
+// original pixel before anything is written, so the blur never touches memory as an image.
+static void unsharp_rows(void *arg, int start_row, int end_row) {
+    unsharp_job_t *job = (unsharp_job_t *)arg;
+    int taps = 2 * job->radius + 1;
+    int n = job->width * job->channels;
+    float *ring = malloc((size_t)taps * n * sizeof(float));
+    float *blur = malloc(n * sizeof(float));
+
+    for (int k = -job->radius; k < job->radius; k++) {
+        int img_y = start_row + k;
+        if (img_y < 0) img_y = 0;
+        if (img_y >= job->height) img_y = job->height - 1;
+        blur_row(job, img_y, ring + (size_t)((start_row + k + taps) % taps) * n);
+    }
+
+    for (int y = start_row; y < end_row; y++) {
+        int img_y = y + job->radius;
+        if (img_y >= job->height) img_y = job->height - 1;
+        blur_row(job, img_y, ring + (size_t)((y + job->radius) % taps) * n);
+
+        for (int i = 0; i < n; i++) blur[i] = 0;
+        for (int k = -job->radius; k <= job->radius; k++) {
+            float w = job->weights[k + job->radius];
+            float *row = ring + (size_t)((y + k + taps) % taps) * n;
+            for (int i = 0; i < n; i++) blur[i] += w * row[i];
+        }
+
+        unsigned char *src = job->input + (size_t)y * n;
+        unsigned char *out = job->output + (size_t)y * n;
+        for (int i = 0; i < n; i++) {
+            float diff = src[i] - blur[i];
+            float value;
+            if (job->highpass) {
+                value = 128 + diff;
+            } else if (fabsf(diff) < job->threshold) {
+                value = src[i];
+            } else {
+                value = src[i] + job->amount * diff;
+            }
+            // Clamp result to [0, 255]
+            out[i] = (unsigned char)(fmaxf(0, fminf(255, value + 0.5f)));
+        }
+        // Alpha is copied through
+        if (job->channels == 2 || job->channels == 4) {
+            for (int i = job->channels - 1; i < n; i += job->channels) out[i] = src[i];
+        }
+    }
+
+    free(ring);
+    free(blur);
+}
+
+static void run_unsharp(unsharp_job_t *job, float sigma) {
+    if (sigma < 0.1f) sigma = 0.1f;
+    job->radius = (int)ceilf(3 * sigma);
+    job->weights = malloc((2 * job->radius + 1) * sizeof(float));
+
+    float total = 0;
+    for (int k = -job->radius; k <= job->radius; k++) {
+        job->weights[k + job->radius] = expf(-(k * k) / (2 * sigma * sigma));
+        total += job->weights[k + job->radius];
+    }
+    for (int k = 0; k < 2 * job->radius + 1; k++) job->weights[k] /= total;
+
+    parallel_rows(job->height, unsharp_rows, job);
+    free(job->weights);
+}
+
+//apply_unsharp: Sharpens by adding amount*(original - gaussian blur) back to the original
+//Parameters: sigma: Standard deviation of the blur, in pixels.  The kernel radius is ceil(3*sigma)
+//            amount: Strength, 1.0 adds the full difference
+//            threshold: Differences smaller than this (0-255) are left alone so flat areas don't pick up noise
+//Alpha is copied through unchanged
+void apply_unsharp(unsigned char *input, unsigned char *output, int width, int height,
+                   int channels, float sigma, float amount, int threshold) {
+    unsharp_job_t job = {input, output, width, height, channels, NULL, 0, amount, threshold, 0};
+    run_unsharp(&job, sigma);
+}
+
+//apply_highpass: Writes 128 + (original - gaussian blur), the detail layer unsharp mask adds back.  Alpha is
+//                copied through.
+void apply_highpass(unsigned char *input, unsigned char *output, int width, int height,
+                    int channels, float sigma) {
+    unsharp_job_t job = {input, output, width, height, channels, NULL, 0, 0, 0, 1};
+    run_unsharp(&job, sigma);
+}
@@ -0,0 +1,9 @@
+#ifndef ___UNSHARP
+#define ___UNSHARP
+
+void apply_unsharp(unsigned char *input, unsigned char *output, int width, int height,
+                   int channels, float sigma, float amount, int threshold);
+void apply_highpass(unsigned char *input, unsigned char *output, int width, int height,
+                    int channels, float sigma);
+
+#endif